@@ -0,0 +1,422 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+/******************************************************************************\
+ * Benchmark Driver
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <memory>
+#include "perf_counters.hpp"
+#include "histogram.hpp"
+
+/******************************************************************************\
+ * Timing.  Every benchmark is timed with the steady clock, which
+ * never jumps, in nanoseconds.
+\******************************************************************************/
+
+typedef std::chrono::steady_clock bench_clock;
+
+inline double elapsed_ns(bench_clock::time_point start,
+                         bench_clock::time_point end) {
+  return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// The cost of reading the clock, measured once: the least time
+// between consecutive readings.
+inline double clock_overhead_ns() {
+  static double overhead = -1.0;
+  if(overhead < 0.0) {
+    overhead = 1e9;
+    for(int i = 0; i < 1000; ++i) {
+      bench_clock::time_point a = bench_clock::now();
+      bench_clock::time_point b = bench_clock::now();
+      overhead = std::min(overhead, elapsed_ns(a, b));
+    }
+  }
+  return overhead;
+}
+
+/******************************************************************************\
+ * Summary statistics of a set of samples, one per timed repetition.
+ * p99 is by nearest rank, so with fewer than 100 samples it is the
+ * slowest repetition.
+\******************************************************************************/
+
+class Stats {
+  std::vector<double> s_;
+
+  double rank(double q) const {
+    if(s_.empty()) return 0.0;
+    std::size_t r = std::size_t(std::ceil(q * s_.size()));
+    return s_[r == 0 ? 0 : r - 1];
+  }
+
+public:
+  explicit Stats(std::vector<double> samples) : s_(samples) {
+    std::sort(s_.begin(), s_.end());
+  }
+
+  std::size_t count() const { return s_.size(); }
+  double min() const { return s_.empty() ? 0.0 : s_.front(); }
+  double max() const { return s_.empty() ? 0.0 : s_.back(); }
+  double median() const {
+    std::size_t n = s_.size();
+    if(n == 0) return 0.0;
+    return n % 2 ? s_[n / 2] : (s_[n / 2 - 1] + s_[n / 2]) / 2.0;
+  }
+  double p99() const { return rank(0.99); }
+  double mean() const {
+    double total = 0.0;
+    for(std::size_t i = 0; i < s_.size(); ++i) total += s_[i];
+    return s_.empty() ? 0.0 : total / s_.size();
+  }
+  // Sample standard deviation.
+  double stddev() const {
+    if(s_.size() < 2) return 0.0;
+    double m = mean(), total = 0.0;
+    for(std::size_t i = 0; i < s_.size(); ++i)
+      total += (s_[i] - m) * (s_[i] - m);
+    return std::sqrt(total / (s_.size() - 1));
+  }
+};
+
+/******************************************************************************\
+ * The samples taken by measure(): the time of each timed repetition
+ * in nanoseconds per operation and, when hardware events are being
+ * counted, the number of each event per operation.
+\******************************************************************************/
+
+struct Samples {
+  std::vector<double> ns;
+  std::vector<std::string> events;
+  std::vector< std::vector<double> > counts;   // counts[event][repetition]
+
+  Samples() : ns(), events(), counts() {}
+  Samples(const std::vector<double> &ns) : ns(ns), events(), counts() {}
+};
+
+/******************************************************************************\
+ * Benchmark options common to every driver, taken from the command
+ * line:
+ *
+ *   --elements=N        number of mappings
+ *   --reps=N            timed repetitions of each benchmark
+ *   --warmup=N          untimed repetitions run first
+ *   --format=csv|json   output format
+ *   --containers=a,b    only run the named containers (default all)
+ *   --counters=a,b      count the named hardware events in every timed
+ *                       repetition (see PerfCounters), or the default
+ *                       set with --counters=default
+ *   --histogram[=B]     after the timed repetitions, run them again
+ *                       timing every batch of B operations (16 by
+ *                       default) and report latency percentiles
+ *
+ * The defaults are given by each driver.
+\******************************************************************************/
+
+struct BenchOptions {
+  enum Format { CSV, JSON };
+
+  std::size_t elements;
+  std::size_t repeats;
+  std::size_t warmup;
+  Format format;
+  std::vector<std::string> containers;
+  // NULL unless --counters was given
+  std::shared_ptr<PerfCounters> counters;
+  // Operations per latency sample, or 0 for no latency histograms
+  std::size_t batch;
+
+  BenchOptions(std::size_t elements, std::size_t repeats) :
+    elements(elements), repeats(repeats), warmup(1), format(CSV),
+    containers(), counters(), batch(0) {}
+
+  // Splits a comma-separated list.
+  static std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::size_t start = 0;
+    while(start <= list.size()) {
+      std::size_t comma = list.find(',', start);
+      if(comma == std::string::npos) comma = list.size();
+      if(comma > start) items.push_back(list.substr(start, comma - start));
+      start = comma + 1;
+    }
+    return items;
+  }
+
+  // Consumes one of the options above, returning false if arg is not
+  // one of them or is malformed.
+  bool parse(const char *arg) {
+    if(strncmp(arg, "--elements=", 11) == 0) {
+      elements = strtoull(arg + 11, NULL, 0);
+      return elements > 0;
+    }
+    if(strncmp(arg, "--reps=", 7) == 0) {
+      repeats = strtoull(arg + 7, NULL, 0);
+      return repeats > 0;
+    }
+    if(strncmp(arg, "--warmup=", 9) == 0) {
+      warmup = strtoull(arg + 9, NULL, 0);
+      return true;
+    }
+    if(strcmp(arg, "--format=csv") == 0) {
+      format = CSV;
+      return true;
+    }
+    if(strcmp(arg, "--format=json") == 0) {
+      format = JSON;
+      return true;
+    }
+    if(strncmp(arg, "--containers=", 13) == 0) {
+      containers = split(arg + 13);
+      return !containers.empty();
+    }
+    if(strcmp(arg, "--histogram") == 0) {
+      batch = 16;
+      return true;
+    }
+    if(strncmp(arg, "--histogram=", 12) == 0) {
+      batch = strtoull(arg + 12, NULL, 0);
+      return batch > 0;
+    }
+    if(strncmp(arg, "--counters=", 11) == 0) {
+      std::string list(arg + 11);
+      std::vector<std::string> names =
+        split(list == "default" ? PerfCounters::defaults() : list);
+      for(std::size_t i = 0; i < names.size(); ++i)
+        if(!PerfCounters::known(names[i])) return false;
+      counters.reset(new PerfCounters(names));
+      return !names.empty();
+    }
+    return false;
+  }
+
+  static const char *usage() {
+    return "[--elements=N] [--reps=N] [--warmup=N] [--format=csv|json]"
+      " [--containers=NAME,...] [--counters=EVENT,...|default]"
+      " [--histogram[=B]]";
+  }
+
+  // Whether the container with the given short name was selected.
+  bool selected(const char *name) const {
+    return containers.empty() ||
+      std::find(containers.begin(), containers.end(), name) !=
+      containers.end();
+  }
+};
+
+/******************************************************************************\
+ * Reporter.  Writes one record per benchmark, as a CSV row or a JSON
+ * object, with the statistics of its samples.  Single measurements,
+ * such as memory use, are reported as one sample.  A JSON report is
+ * an array which is closed when the Reporter is destroyed.
+\******************************************************************************/
+
+class Reporter {
+  std::ostream &out_;
+  BenchOptions::Format format_;
+  bool first_;
+
+  static std::string quote(const std::string &s) {
+    std::string q("\"");
+    for(std::size_t i = 0; i < s.size(); ++i) {
+      if(s[i] == '"' || s[i] == '\\') q += '\\';
+      q += s[i];
+    }
+    return q + "\"";
+  }
+
+public:
+  Reporter(const BenchOptions &o, std::ostream &out = std::cout) :
+    out_(out), format_(o.format), first_(true) {
+    out_.precision(10);
+    if(format_ == BenchOptions::CSV)
+      out_ << "container,operation,elements,unit,samples,"
+           << "min,median,p99,mean,stddev" << std::endl;
+    else
+      out_ << "[";
+  }
+  Reporter(const Reporter&) = delete;
+  Reporter& operator=(const Reporter&) = delete;
+  ~Reporter() {
+    if(format_ == BenchOptions::JSON) out_ << "\n]" << std::endl;
+  }
+
+  void row(const std::string &container, const std::string &op,
+           std::size_t elements, const char *unit, const Stats &s) {
+    if(format_ == BenchOptions::CSV) {
+      out_ << container << "," << op << "," << elements << "," << unit
+           << "," << s.count() << "," << s.min() << "," << s.median()
+           << "," << s.p99() << "," << s.mean() << "," << s.stddev()
+           << std::endl;
+    } else {
+      out_ << (first_ ? "\n" : ",\n")
+           << "  {\"container\": " << quote(container)
+           << ", \"operation\": " << quote(op)
+           << ", \"elements\": " << elements
+           << ", \"unit\": " << quote(unit)
+           << ", \"samples\": " << s.count()
+           << ", \"min\": " << s.min()
+           << ", \"median\": " << s.median()
+           << ", \"p99\": " << s.p99()
+           << ", \"mean\": " << s.mean()
+           << ", \"stddev\": " << s.stddev() << "}";
+      out_.flush();
+    }
+    first_ = false;
+  }
+
+  void row(const std::string &container, const std::string &op,
+           std::size_t elements, const char *unit,
+           const std::vector<double> &samples) {
+    row(container, op, elements, unit, Stats(samples));
+  }
+
+  // Reports the times, and then each event counted as a row of its
+  // own, named after the operation and the event.
+  void row(const std::string &container, const std::string &op,
+           std::size_t elements, const char *unit, const Samples &s) {
+    row(container, op, elements, unit, Stats(s.ns));
+    for(std::size_t i = 0; i < s.events.size(); ++i) {
+      row(container, op + ":" + s.events[i], elements, "events/op",
+          Stats(s.counts[i]));
+    }
+  }
+
+  // Reports percentiles of a latency histogram as rows named after
+  // the operation and the percentile, each a single value.
+  template<unsigned SubBits>
+  void latency(const std::string &container, const std::string &op,
+               std::size_t elements,
+               const LatencyHistogram<SubBits> &h) {
+    const double q[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+    const char *names[] = { "p50", "p90", "p99", "p99.9", "p99.99" };
+    for(std::size_t i = 0; i < sizeof(q) / sizeof(q[0]); ++i)
+      value(container, op + ":" + names[i], elements, "ns/op",
+            h.percentile(q[i]));
+    value(container, op + ":max", elements, "ns/op", h.max());
+  }
+
+  void value(const std::string &container, const std::string &op,
+             std::size_t elements, const char *unit, double v) {
+    row(container, op, elements, unit, Stats(std::vector<double>(1, v)));
+  }
+};
+
+/******************************************************************************\
+ * Runs setup() and then body() o.warmup times untimed, and then
+ * o.repeats times timing only body(), and returns the time of each
+ * timed run in nanoseconds per operation, where body() performs ops
+ * operations.  Any hardware events in o.counters are counted around
+ * body() alone.
+\******************************************************************************/
+
+template<class Setup, class Body>
+Samples measure(const BenchOptions &o, std::size_t ops,
+                Setup setup, Body body) {
+  Samples s;
+  PerfCounters *perf = o.counters.get();
+  if(perf != NULL) {
+    for(std::size_t e = 0; e < perf->size(); ++e)
+      s.events.push_back(perf->name(e));
+    s.counts.resize(perf->size());
+  }
+  for(std::size_t i = 0; i < o.warmup; ++i) {
+    setup();
+    body();
+  }
+  for(std::size_t i = 0; i < o.repeats; ++i) {
+    setup();
+    if(perf != NULL) perf->start();
+    bench_clock::time_point start = bench_clock::now();
+    body();
+    bench_clock::time_point end = bench_clock::now();
+    if(perf != NULL) {
+      std::vector<double> counts = perf->stop();
+      for(std::size_t e = 0; e < counts.size(); ++e)
+        s.counts[e].push_back(counts[e] / double(ops));
+    }
+    s.ns.push_back(elapsed_ns(start, end) / double(ops));
+  }
+  return s;
+}
+
+/******************************************************************************\
+ * Runs setup() and then op(i) for i in [0, ops) o.repeats times,
+ * timing each batch of o.batch operations and recording its time per
+ * operation in h, with the clock overhead subtracted and negative
+ * times clamped to 0.  o.warmup is not applied.  Reading the clock
+ * once per batch keeps the cost of measuring below that of a single
+ * radix lookup.
+\******************************************************************************/
+
+template<class Setup, class Op, unsigned SubBits>
+void sample_latency(const BenchOptions &o, std::size_t ops,
+                    LatencyHistogram<SubBits> &h, Setup setup, Op op) {
+  const double overhead = clock_overhead_ns();
+  for(std::size_t r = 0; r < o.repeats; ++r) {
+    setup();
+    bench_clock::time_point start = bench_clock::now();
+    for(std::size_t base = 0; base < ops; base += o.batch) {
+      std::size_t end = std::min(ops, base + o.batch);
+      for(std::size_t i = base; i != end; ++i) op(i);
+      bench_clock::time_point t = bench_clock::now();
+      h.record((elapsed_ns(start, t) - overhead) / double(end - base),
+               end - base);
+      start = t;
+    }
+  }
+}
+
+/******************************************************************************\
+ * The insert and search benchmark shared by the drivers.  clear()
+ * empties the structure, insert(i) inserts the i-th of numInserts
+ * mappings, and find(i) looks up the i-th of numLookups and returns
+ * whether it was found.  The structure is left full.  With
+ * --histogram, each phase is followed by a pass recording latencies.
+\******************************************************************************/
+
+template<class Clear, class Insert, class Find>
+void bench_insert_search(Reporter &report, const BenchOptions &o,
+                         const std::string &name,
+                         std::size_t numInserts, std::size_t numLookups,
+                         Clear clear, Insert insert, Find find) {
+  report.row(name, "insert", numInserts, "ns/op",
+             measure(o, numInserts, clear, [&]() {
+                 for(std::size_t i = 0; i != numInserts; ++i) insert(i);
+               }));
+  if(o.batch > 0) {
+    LatencyHistogram<> h;
+    sample_latency(o, numInserts, h, clear, insert);
+    report.latency(name, "insert", numInserts, h);
+  }
+  std::size_t found = 0;
+  Samples times =
+    measure(o, numLookups, [&]() { found = 0; }, [&]() {
+        for(std::size_t i = 0; i != numLookups; ++i)
+          found += static_cast<std::size_t>(find(i));
+      });
+  if(found != numLookups) {
+    std::cerr << "    ERROR: not all found, "
+              << found << " found out of " << numLookups << std::endl;
+  }
+  report.row(name, "search", numInserts, "ns/op", times);
+  if(o.batch > 0) {
+    LatencyHistogram<> h;
+    sample_latency(o, numLookups, h, []() {}, find);
+    report.latency(name, "search", numInserts, h);
+  }
+}
+
+/******************************************************************************/
+#endif
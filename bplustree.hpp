@@ -0,0 +1,389 @@
+#ifndef BPLUSTREE_HPP
+#define BPLUSTREE_HPP
+/******************************************************************************\
+ * B+ Tree
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+/******************************************************************************\
+ * B+ Tree.  An ordered map from virtual address to physical address,
+ * or to any other trivially copyable Value, with Fanout keys to a
+ * node.  Every mapping lives in a leaf, leaves are linked in key order
+ * for range scans, and inner nodes hold only separator keys and child
+ * pointers.  Nodes are aligned to cache lines: with the default
+ * fan-out of 16 an inner node's keys fill two lines, and a lookup in a
+ * million mappings visits five nodes where a binary tree visits
+ * twenty.
+ *
+ * Within a node the keys are not searched but counted: the position
+ * of k is the number of keys below it, which is found by comparing k
+ * against four keys at a time with AVX2 (two with SSE4.2) and taking
+ * the population count of the mask, without a branch per key.  Builds
+ * without either count one key at a time.
+ *
+ * Erasing never merges nodes; a leaf is freed only once it is empty,
+ * and an inner node once it has no children left.  The tree can then
+ * be sparser than a textbook B+ tree, but never deeper.
+\******************************************************************************/
+
+template <unsigned Fanout = 16, class Value = uint64_t>
+class BPlusTree {
+  static_assert(Fanout >= 4 && Fanout % 4 == 0 && Fanout <= 64,
+                "Fanout must be a multiple of 4 between 4 and 64");
+  static_assert(std::is_trivially_copyable<Value>::value,
+                "Values are moved with memcpy");
+
+  struct Leaf {
+    uint64_t keys[Fanout];
+    Value vals[Fanout];
+    Leaf *prev, *next;
+    unsigned n;
+  };
+
+  // n children, separated by n - 1 keys: keys[i] is the smallest key
+  // under child[i + 1].
+  struct Inner {
+    uint64_t keys[Fanout];
+    void *child[Fanout + 1];
+    unsigned n;
+  };
+
+  void *root_;
+  unsigned height_;   // Levels of inner nodes above the leaves
+  Leaf *first_;
+  size_t s_;
+  size_t leaves_, inners_;
+
+  template <class Node>
+  static Node *alloc() {
+    void *p = NULL;
+    if(posix_memalign(&p, 64, sizeof(Node)) != 0) throw std::bad_alloc();
+    return new (p) Node();
+  }
+
+  // Number of the first n keys which are below k.
+  static unsigned count_less(const uint64_t *keys, unsigned n, uint64_t k) {
+#if defined(__AVX2__)
+    // There is no unsigned 64-bit compare, so flip the sign bits
+    const __m256i bias = _mm256_set1_epi64x(int64_t(1ULL << 63));
+    const __m256i vk = _mm256_xor_si256(_mm256_set1_epi64x(int64_t(k)), bias);
+    uint64_t mask = 0;
+    for(unsigned i = 0; i < n; i += 4) {
+      __m256i v = _mm256_xor_si256(
+        _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+      uint64_t m = unsigned(_mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_cmpgt_epi64(vk, v))));
+      mask |= m << i;
+    }
+    if(n < 64) mask &= (1ULL << n) - 1;
+    return unsigned(__builtin_popcountll(mask));
+#elif defined(__SSE4_2__)
+    const __m128i bias = _mm_set1_epi64x(int64_t(1ULL << 63));
+    const __m128i vk = _mm_xor_si128(_mm_set1_epi64x(int64_t(k)), bias);
+    uint64_t mask = 0;
+    for(unsigned i = 0; i < n; i += 2) {
+      __m128i v = _mm_xor_si128(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+      uint64_t m = unsigned(_mm_movemask_pd(
+        _mm_castsi128_pd(_mm_cmpgt_epi64(vk, v))));
+      mask |= m << i;
+    }
+    if(n < 64) mask &= (1ULL << n) - 1;
+    return unsigned(__builtin_popcountll(mask));
+#else
+    unsigned c = 0;
+    for(unsigned i = 0; i < n; ++i) c += keys[i] < k;
+    return c;
+#endif
+  }
+
+  // Index of the child of in under which k belongs.
+  static unsigned child_index(const Inner *in, uint64_t k) {
+    // The number of keys at or below k
+    if(k == ~0ULL) return in->n - 1;
+    return count_less(in->keys, in->n - 1, k + 1);
+  }
+
+  Leaf *find_leaf(uint64_t k) const {
+    void *node = root_;
+    for(unsigned h = height_; h > 0; --h) {
+      const Inner *in = static_cast<const Inner*>(node);
+      node = in->child[child_index(in, k)];
+    }
+    return static_cast<Leaf*>(node);
+  }
+
+  // Inserts into the leaf l, splitting it if full.  Returns the new
+  // right-hand leaf if it split, setting sep to its first key.
+  Leaf *insert_leaf(Leaf *l, uint64_t k, const Value &v, uint64_t &sep) {
+    unsigned i = count_less(l->keys, l->n, k);
+    if(i < l->n && l->keys[i] == k) {
+      l->vals[i] = v;
+      return NULL;
+    }
+    ++s_;
+    if(l->n < Fanout) {
+      memmove(l->keys + i + 1, l->keys + i, (l->n - i) * sizeof(uint64_t));
+      memmove(l->vals + i + 1, l->vals + i, (l->n - i) * sizeof(Value));
+      l->keys[i] = k;
+      l->vals[i] = v;
+      ++l->n;
+      return NULL;
+    }
+    // Split the Fanout + 1 entries between l and a new right leaf
+    Leaf *r = alloc<Leaf>();
+    ++leaves_;
+    const unsigned left = (Fanout + 1) / 2;
+    unsigned from = 0;
+    uint64_t keys[Fanout + 1];
+    Value vals[Fanout + 1];
+    for(unsigned j = 0; j <= Fanout; ++j) {
+      if(j == i) {
+        keys[j] = k;
+        vals[j] = v;
+      } else {
+        keys[j] = l->keys[from];
+        vals[j] = l->vals[from++];
+      }
+    }
+    memcpy(l->keys, keys, left * sizeof(uint64_t));
+    memcpy(l->vals, vals, left * sizeof(Value));
+    l->n = left;
+    r->n = Fanout + 1 - left;
+    memcpy(r->keys, keys + left, r->n * sizeof(uint64_t));
+    memcpy(r->vals, vals + left, r->n * sizeof(Value));
+    r->prev = l;
+    r->next = l->next;
+    if(l->next != NULL) l->next->prev = r;
+    l->next = r;
+    sep = r->keys[0];
+    return r;
+  }
+
+  // Adds child c, whose keys begin at sep, after child i of in,
+  // splitting in if full.  Returns the new right-hand node if it
+  // split, setting sep to the key which separates the two.
+  Inner *insert_child(Inner *in, unsigned i, uint64_t &sep, void *c) {
+    if(in->n < Fanout + 1) {
+      memmove(in->keys + i + 1, in->keys + i,
+              (in->n - 1 - i) * sizeof(uint64_t));
+      memmove(in->child + i + 2, in->child + i + 1,
+              (in->n - 1 - i) * sizeof(void*));
+      in->keys[i] = sep;
+      in->child[i + 1] = c;
+      ++in->n;
+      return NULL;
+    }
+    // Split the Fanout + 2 children between in and a new right node,
+    // moving the middle key up
+    uint64_t keys[Fanout + 1];
+    void *child[Fanout + 2];
+    memcpy(keys, in->keys, i * sizeof(uint64_t));
+    memcpy(child, in->child, (i + 1) * sizeof(void*));
+    keys[i] = sep;
+    child[i + 1] = c;
+    memcpy(keys + i + 1, in->keys + i, (Fanout - i) * sizeof(uint64_t));
+    memcpy(child + i + 2, in->child + i + 1, (Fanout - i) * sizeof(void*));
+    Inner *r = alloc<Inner>();
+    ++inners_;
+    const unsigned left = (Fanout + 2) / 2;
+    in->n = left;
+    memcpy(in->keys, keys, (left - 1) * sizeof(uint64_t));
+    memcpy(in->child, child, left * sizeof(void*));
+    sep = keys[left - 1];
+    r->n = Fanout + 2 - left;
+    memcpy(r->keys, keys + left, (r->n - 1) * sizeof(uint64_t));
+    memcpy(r->child, child + left, r->n * sizeof(void*));
+    return r;
+  }
+
+  // Returns the new right-hand sibling of node if it split.
+  void *insert(void *node, unsigned h, uint64_t k, const Value &v,
+               uint64_t &sep) {
+    if(h == 0) return insert_leaf(static_cast<Leaf*>(node), k, v, sep);
+    Inner *in = static_cast<Inner*>(node);
+    unsigned i = child_index(in, k);
+    void *c = insert(in->child[i], h - 1, k, v, sep);
+    return c == NULL ? NULL : insert_child(in, i, sep, c);
+  }
+
+  enum Erased { ABSENT, ERASED, EMPTIED };
+
+  Erased erase(void *node, unsigned h, uint64_t k) {
+    if(h == 0) {
+      Leaf *l = static_cast<Leaf*>(node);
+      unsigned i = count_less(l->keys, l->n, k);
+      if(i == l->n || l->keys[i] != k) return ABSENT;
+      --l->n;
+      --s_;
+      memmove(l->keys + i, l->keys + i + 1, (l->n - i) * sizeof(uint64_t));
+      memmove(l->vals + i, l->vals + i + 1, (l->n - i) * sizeof(Value));
+      if(l->n > 0) return ERASED;
+      if(l->prev != NULL) l->prev->next = l->next;
+      else first_ = l->next;
+      if(l->next != NULL) l->next->prev = l->prev;
+      return EMPTIED;
+    }
+    Inner *in = static_cast<Inner*>(node);
+    unsigned i = child_index(in, k);
+    Erased e = erase(in->child[i], h - 1, k);
+    if(e != EMPTIED) return e;
+    free_node(in->child[i], h - 1);
+    // Drop the child and the key before it, or after it if it was first
+    unsigned ki = i > 0 ? i - 1 : 0;
+    --in->n;
+    if(in->n > 0) {
+      memmove(in->keys + ki, in->keys + ki + 1,
+              (in->n - 1 - ki) * sizeof(uint64_t));
+    }
+    memmove(in->child + i, in->child + i + 1, (in->n - i) * sizeof(void*));
+    return in->n > 0 ? ERASED : EMPTIED;
+  }
+
+  void free_node(void *node, unsigned h) {
+    if(h == 0) --leaves_;
+    else --inners_;
+    ::free(node);
+  }
+
+  void destroy(void *node, unsigned h) {
+    if(h > 0) {
+      Inner *in = static_cast<Inner*>(node);
+      for(unsigned i = 0; i < in->n; ++i) destroy(in->child[i], h - 1);
+    }
+    free_node(node, h);
+  }
+
+  void reset() {
+    Leaf *l = alloc<Leaf>();
+    root_ = first_ = l;
+    height_ = 0;
+    s_ = 0;
+    leaves_ = 1;
+    inners_ = 0;
+  }
+
+public:
+  class iterator {
+    Leaf *l_;
+    unsigned i_;
+    friend class BPlusTree;
+
+  public:
+    iterator(Leaf *l = NULL, unsigned i = 0) : l_(l), i_(i) {
+      // Positions past the end of a leaf are the start of the next
+      while(l_ != NULL && i_ == l_->n) {
+        l_ = l_->next;
+        i_ = 0;
+      }
+    }
+    uint64_t key() const { return l_->keys[i_]; }
+    const Value &value() const { return l_->vals[i_]; }
+    const Value &operator*() const { return value(); }
+    iterator& operator++() {
+      if(++i_ == l_->n) {
+        l_ = l_->next;
+        i_ = 0;
+      }
+      return *this;
+    }
+    bool operator==(const iterator &o) const {
+      return l_ == o.l_ && i_ == o.i_;
+    }
+    bool operator!=(const iterator &o) const { return !(*this == o); }
+  };
+
+  BPlusTree() { reset(); }
+  BPlusTree(const BPlusTree&) = delete;
+  BPlusTree& operator=(const BPlusTree&) = delete;
+  ~BPlusTree() { destroy(root_, height_); }
+
+  // Maps vadd to padd, replacing any mapping for vadd.
+  void insert(uint64_t vadd, const Value &padd) {
+    uint64_t sep;
+    void *r = insert(root_, height_, vadd, padd, sep);
+    if(r == NULL) return;
+    Inner *in = alloc<Inner>();
+    ++inners_;
+    in->n = 2;
+    in->keys[0] = sep;
+    in->child[0] = root_;
+    in->child[1] = r;
+    root_ = in;
+    ++height_;
+  }
+
+  // Removes the mapping for vadd, returning whether there was one.
+  bool erase(uint64_t vadd) {
+    Erased e = erase(root_, height_, vadd);
+    if(e == ABSENT) return false;
+    if(e == EMPTIED) {
+      destroy(root_, height_);
+      reset();
+      return true;
+    }
+    // Drop roots left with a single child
+    while(height_ > 0 && static_cast<Inner*>(root_)->n == 1) {
+      void *c = static_cast<Inner*>(root_)->child[0];
+      free_node(root_, height_);
+      root_ = c;
+      --height_;
+    }
+    return true;
+  }
+
+  iterator find(uint64_t vadd) {
+    Leaf *l = find_leaf(vadd);
+    unsigned i = count_less(l->keys, l->n, vadd);
+    if(i == l->n || l->keys[i] != vadd) return end();
+    return iterator(l, i);
+  }
+
+  // The first mapping at or above vadd.
+  iterator lower_bound(uint64_t vadd) {
+    Leaf *l = find_leaf(vadd);
+    return iterator(l, count_less(l->keys, l->n, vadd));
+  }
+
+  // The last mapping at or below vadd, or end() if there is none.
+  iterator floor(uint64_t vadd) {
+    Leaf *l = find_leaf(vadd);
+    unsigned i = vadd == ~0ULL ? l->n : count_less(l->keys, l->n, vadd + 1);
+    if(i > 0) return iterator(l, i - 1);
+    // Every key in this leaf is above vadd, which happens when the
+    // first of them has been erased, so the answer ends the previous
+    // leaf.  Only an empty tree has empty leaves.
+    l = l->prev;
+    return l == NULL ? end() : iterator(l, l->n - 1);
+  }
+
+  iterator begin() { return iterator(first_, 0); }
+  iterator end() { return iterator(); }
+
+  void clear() {
+    destroy(root_, height_);
+    reset();
+  }
+
+  size_t size() { return s_; }
+  unsigned height() { return height_ + 1; }
+  size_t nodes() { return leaves_ + inners_; }
+  size_t memory_bytes() {
+    return sizeof(*this) + leaves_ * sizeof(Leaf) + inners_ * sizeof(Inner);
+  }
+};
+
+/******************************************************************************/
+#endif
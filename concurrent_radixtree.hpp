@@ -0,0 +1,367 @@
+#ifndef CONCURRENT_RADIXTREE_HPP
+#define CONCURRENT_RADIXTREE_HPP
+/******************************************************************************\
+ * Concurrent Radix Tree
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <new>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Epoch Manager.  A minimal epoch-based reclamation scheme.  Every
+ * thread which reads shared tables does so inside a Guard, which
+ * announces the global epoch it started in.  A writer which unlinks
+ * a table retires it, tagging it with the global epoch and advancing
+ * that epoch; it is freed once no reader announced at or before its
+ * tag remains.
+ *
+ * A reader fences after announcing its epoch and reclamation fences
+ * before scanning the announcements, so either the scan sees the
+ * reader or the reader sees the table unlinked.  The reader then
+ * checks that the global epoch has not moved, and announces again if
+ * it has, so that the epoch it holds is never older than a table it
+ * can still find.
+ *
+ * Threads are given a slot on first use, and give it back when they
+ * exit; at most max_threads of them may use the manager at once, and
+ * the first use by one more throws std::runtime_error.
+\******************************************************************************/
+
+class EpochManager {
+public:
+  static const size_t max_threads = 128;
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch;   // 0 when not in a Guard
+  };
+
+  std::atomic<uint64_t> global_;
+  Slot slots_[max_threads];
+  std::mutex retired_lock_;
+  std::vector< std::pair<uint64_t, void*> > retired_;
+
+  // Claims a free slot for the calling thread, which it gives back
+  // when it exits.
+  struct SlotOwner {
+    size_t slot;
+    SlotOwner() : slot(0) {
+      while(slot < max_threads && in_use()[slot].exchange(true)) ++slot;
+      if(slot == max_threads)
+        throw std::runtime_error("too many threads in EpochManager");
+    }
+    ~SlotOwner() { in_use()[slot].store(false); }
+  };
+
+  static std::atomic<bool> *in_use() {
+    static std::atomic<bool> used[max_threads];
+    return used;
+  }
+
+  static size_t thread_slot() {
+    thread_local SlotOwner owner;
+    return owner.slot;
+  }
+
+  uint64_t min_active() {
+    uint64_t m = UINT64_MAX;
+    for(size_t i = 0; i < max_threads; ++i) {
+      uint64_t e = slots_[i].epoch.load();
+      if(e != 0 && e < m) m = e;
+    }
+    return m;
+  }
+
+  // Frees everything retired before the oldest active reader.
+  // Called with retired_lock_ held.
+  void reclaim() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t m = min_active();
+    size_t kept = 0;
+    for(size_t i = 0; i < retired_.size(); ++i) {
+      if(retired_[i].first < m) ::free(retired_[i].second);
+      else retired_[kept++] = retired_[i];
+    }
+    retired_.resize(kept);
+  }
+
+public:
+  class Guard {
+    EpochManager &m_;
+    size_t slot_;
+  public:
+    Guard(EpochManager &m) : m_(m), slot_(thread_slot()) {
+      std::atomic<uint64_t> &mine = m_.slots_[slot_].epoch;
+      uint64_t e = m_.global_.load();
+      for(;;) {
+        mine.store(e);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t now = m_.global_.load();
+        if(now == e) break;
+        e = now;
+      }
+    }
+    ~Guard() {
+      m_.slots_[slot_].epoch.store(0, std::memory_order_release);
+    }
+  };
+
+  EpochManager() : global_(1), retired_() {
+    for(size_t i = 0; i < max_threads; ++i) slots_[i].epoch.store(0);
+  }
+  ~EpochManager() {
+    for(size_t i = 0; i < retired_.size(); ++i) ::free(retired_[i].second);
+  }
+
+  // p must already be unreachable from the shared structure.
+  void retire(void *p) {
+    uint64_t tag = global_.fetch_add(1);
+    std::lock_guard<std::mutex> lock(retired_lock_);
+    retired_.push_back(std::make_pair(tag, p));
+    if(retired_.size() >= 64) reclaim();
+  }
+
+  // Frees whatever no active reader can still hold.
+  void collect() {
+    std::lock_guard<std::mutex> lock(retired_lock_);
+    reclaim();
+  }
+
+  // Number retired but not yet freed.
+  size_t pending() {
+    std::lock_guard<std::mutex> lock(retired_lock_);
+    return retired_.size();
+  }
+};
+
+/******************************************************************************\
+ * Concurrent Radix Tree.  The same four-level layout of 4 KB pages as
+ * RadixTree, for one or more writers running alongside lock-free
+ * readers.
+ *
+ * find() takes no locks: it walks the tree with acquire loads inside
+ * an epoch Guard.  Writers lock only the table they modify, using a
+ * spin lock kept with the table.  A new table is published with a
+ * release store of its entry, under the parent's lock, so that
+ * readers see it fully zeroed.  When erase() empties a table, it
+ * locks the parent and then the table (always in that order), marks
+ * the table dead, unlinks it and retires it to the epoch manager.  A
+ * writer which finds a dead table under its lock starts again from
+ * the root.
+ *
+ * Tables are allocated individually rather than from a TablePool, as
+ * they are freed by whichever thread reclaims them, so each one
+ * carries its own lock and entry count after its 512 entries.
+\******************************************************************************/
+
+class ConcurrentRadixTree {
+  static const size_t table_size = 512;
+  static const uint64_t PRESENT = 1ULL << 0;
+  // Bits 51:12
+  static const uint64_t ADDR_MASK = 0x000ffffffffff000ULL;
+
+  struct Table {
+    std::atomic<uint64_t> e[table_size];
+    std::atomic<bool> lock;
+    bool dead;
+    uint16_t count;
+  };
+
+  EpochManager epochs_;
+  Table *t_;
+  std::atomic<size_t> s_;
+  std::atomic<size_t> tables_;   // Linked tables, including the root
+
+  typedef PageTableLayout<12, 9, 9, 9, 9> layout;
+
+  static size_t key(uint64_t vadd, unsigned level) {
+    return (vadd >> layout::shift(level)) & (table_size - 1);
+  }
+
+  static Table *entry_table(uint64_t e) {
+    return reinterpret_cast<Table*>(e & ~PRESENT);
+  }
+
+  static void lock(Table *t) {
+    while(t->lock.exchange(true, std::memory_order_acquire)) {}
+  }
+
+  static void unlock(Table *t) {
+    t->lock.store(false, std::memory_order_release);
+  }
+
+  static Table *alloc_table() {
+    void *p = NULL;
+    if(posix_memalign(&p, 64, sizeof(Table)) != 0)
+      throw std::bad_alloc();
+    Table *t = static_cast<Table*>(p);
+    for(size_t i = 0; i < table_size; ++i) t->e[i].store(0);
+    t->lock.store(false);
+    t->dead = false;
+    t->count = 0;
+    return t;
+  }
+
+  // Only used when no other thread can reach the tree.
+  static void free_table(Table *t, unsigned level) {
+    if(level > 1) {
+      for(size_t i = 0; i < table_size; ++i) {
+        uint64_t e = t->e[i].load(std::memory_order_relaxed);
+        if(e & PRESENT) free_table(entry_table(e), level - 1);
+      }
+    }
+    ::free(t);
+  }
+
+  // Returns the child of t for vadd at the given level, allocating it
+  // if need be, or NULL if t has been unlinked.
+  Table *descend(Table *t, uint64_t vadd, unsigned level) {
+    std::atomic<uint64_t> &e = t->e[key(vadd, level)];
+    uint64_t v = e.load(std::memory_order_acquire);
+    if(v & PRESENT) return entry_table(v);
+    lock(t);
+    if(t->dead) {
+      unlock(t);
+      return NULL;
+    }
+    v = e.load(std::memory_order_relaxed);
+    if(!(v & PRESENT)) {
+      v = reinterpret_cast<uint64_t>(alloc_table()) | PRESENT;
+      e.store(v, std::memory_order_release);
+      ++t->count;
+      ++tables_;
+    }
+    unlock(t);
+    return entry_table(v);
+  }
+
+  // Unlinks and retires the empty tables on the path to vadd, from
+  // the p1 table upwards.  path[level] is the table at that level.
+  void reclaim_path(Table **path, uint64_t vadd) {
+    for(unsigned level = 1; level < 4; ++level) {
+      Table *parent = path[level + 1], *t = path[level];
+      std::atomic<uint64_t> &e = parent->e[key(vadd, level + 1)];
+      lock(parent);
+      lock(t);
+      bool unlink = !parent->dead && !t->dead && t->count == 0 &&
+        entry_table(e.load(std::memory_order_relaxed)) == t;
+      if(unlink) {
+        t->dead = true;
+        e.store(0, std::memory_order_release);
+        --parent->count;
+        --tables_;
+      }
+      bool parent_empty = parent->count == 0;
+      unlock(t);
+      unlock(parent);
+      if(!unlink) return;
+      epochs_.retire(t);
+      if(!parent_empty) return;
+    }
+  }
+
+public:
+  ConcurrentRadixTree()
+    : epochs_(), t_(alloc_table()), s_(0), tables_(1) {}
+  ConcurrentRadixTree(const ConcurrentRadixTree&) = delete;
+  ConcurrentRadixTree& operator=(const ConcurrentRadixTree&) = delete;
+  ~ConcurrentRadixTree() { free_table(t_, 4); }
+
+  void insert(uint64_t vadd, uint64_t padd) {
+    EpochManager::Guard g(epochs_);
+    for(;;) {
+      Table *t = t_;
+      for(unsigned level = 4; t != NULL && level > 1; --level)
+        t = descend(t, vadd, level);
+      if(t == NULL) continue;
+      lock(t);
+      if(t->dead) {
+        unlock(t);
+        continue;
+      }
+      std::atomic<uint64_t> &e = t->e[key(vadd, 1)];
+      if(!(e.load(std::memory_order_relaxed) & PRESENT)) {
+        ++t->count;
+        ++s_;
+      }
+      e.store((padd & ADDR_MASK) | PRESENT, std::memory_order_release);
+      unlock(t);
+      return;
+    }
+  }
+
+  // Removes the 4 KB page containing vadd, returning whether it was
+  // mapped.
+  bool erase(uint64_t vadd) {
+    EpochManager::Guard g(epochs_);
+    for(;;) {
+      Table *path[5];
+      path[4] = t_;
+      for(unsigned level = 4; level > 1; --level) {
+        uint64_t v = path[level]->e[key(vadd, level)].load(
+          std::memory_order_acquire);
+        if(!(v & PRESENT)) return false;
+        path[level - 1] = entry_table(v);
+      }
+      Table *t = path[1];
+      lock(t);
+      if(t->dead) {
+        unlock(t);
+        continue;
+      }
+      std::atomic<uint64_t> &e = t->e[key(vadd, 1)];
+      if(!(e.load(std::memory_order_relaxed) & PRESENT)) {
+        unlock(t);
+        return false;
+      }
+      e.store(0, std::memory_order_release);
+      --s_;
+      bool empty = --t->count == 0;
+      unlock(t);
+      if(empty) reclaim_path(path, vadd);
+      return true;
+    }
+  }
+
+  RadixTreeIterator find(uint64_t vadd) {
+    EpochManager::Guard g(epochs_);
+    Table *t = t_;
+    for(unsigned level = 4; level > 1; --level) {
+      uint64_t v = t->e[key(vadd, level)].load(std::memory_order_acquire);
+      if(!(v & PRESENT)) return end();
+      t = entry_table(v);
+    }
+    uint64_t v = t->e[key(vadd, 1)].load(std::memory_order_acquire);
+    if(!(v & PRESENT)) return end();
+    return RadixTreeIterator(vadd, (v & ADDR_MASK) | (vadd & 0xfff));
+  }
+
+  RadixTreeIterator end() { return RadixTreeIterator(-1, -1, true); }
+
+  // Not safe to call while other threads use the tree.
+  void clear() {
+    free_table(t_, 4);
+    t_ = alloc_table();
+    s_ = 0;
+    tables_ = 1;
+  }
+
+  size_t size() { return s_.load(); }
+  size_t tables() { return tables_.load(); }
+  // Tables unlinked by erase() and not yet freed.
+  size_t retired() { return epochs_.pending(); }
+  // Frees the retired tables which no reader can still reach.
+  void collect() { epochs_.collect(); }
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,536 @@
+#ifndef CONTAINERS_HPP
+#define CONTAINERS_HPP
+/******************************************************************************\
+ * Memory Containers
+ * MIT License
+ * Copyright 2016, Simon Pratt
+ *
+ * Much of this code comes from the Boost docs:
+ * https://github.com/boostorg/intrusive/blob/develop/perf/tree_perf_test.cpp
+ * http://www.boost.org/doc/libs/1_60_0/doc/html/intrusive/set_multiset.html
+ * http://www.boost.org/doc/libs/1_60_0/doc/html/intrusive/avl_set_multiset.html
+\******************************************************************************/
+
+#include <boost/intrusive/rbtree.hpp>
+#include <boost/intrusive/avltree.hpp>
+#include <boost/intrusive/splaytree.hpp>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "radixtree.hpp"
+#include "rangetree.hpp"
+#include "mapletree.hpp"
+#include "hashed_pagetable.hpp"
+#include "swiss_table.hpp"
+#include "bplustree.hpp"
+
+using namespace boost::intrusive;
+
+/******************************************************************************/
+
+class MemoryMapping : public set_base_hook<optimize_size<false> >,
+                      public avl_set_base_hook<optimize_size<false> >,
+                      public bs_set_base_hook<optimize_size<false> >
+{
+  std::uint64_t va_;
+  std::uint64_t pa_;
+
+public:
+  set_member_hook<> member_hook_;
+
+  MemoryMapping(uint64_t va, uint64_t pa) : va_(va), pa_(pa) {}
+
+  std::uint64_t getVA() { return va_; }
+  std::uint64_t getPA() { return pa_; }
+
+  friend bool operator< (const MemoryMapping &a, const MemoryMapping &b)
+  { return a.va_ < b.va_; }
+  friend bool operator> (const MemoryMapping &a, const MemoryMapping &b)
+  { return a.va_ > b.va_; }
+  friend bool operator== (const MemoryMapping &a, const MemoryMapping &b)
+  { return a.va_ == b.va_; }  
+};
+
+// Define trees using the base hook
+typedef rbtree<    MemoryMapping, compare<std::less<MemoryMapping> > >     RBTree;
+typedef avltree<   MemoryMapping, compare<std::less<MemoryMapping> > >     AVLTree;
+typedef splaytree< MemoryMapping, compare<std::less<MemoryMapping> > >     SplayTree;
+
+/******************************************************************************/
+
+template<class Iterator>
+class MemoryContainer {
+public:
+  virtual void insert(MemoryMapping&) = 0;
+  virtual Iterator end() = 0;
+  virtual Iterator find(MemoryMapping&) = 0;
+  virtual void clear() = 0;
+  virtual std::size_t size() = 0;
+  // Bytes of memory used by the container, including its nodes or
+  // tables and their metadata.  The trees are intrusive, so each of
+  // their nodes is a whole MemoryMapping.
+  virtual std::size_t memory_bytes() = 0;
+  // Removes the mapping for the page of mm.  Returns the
+  // MemoryMapping the container held for it, which for the intrusive
+  // trees is the one passed to insert(), or NULL if the page was not
+  // mapped.  Containers which copy mappings in return &mm.
+  virtual MemoryMapping *erase(MemoryMapping &mm) = 0;
+  // Whether the container links the MemoryMappings passed to insert()
+  // into itself, so that they must outlive their time in it.
+  virtual bool holds_mappings() { return false; }
+  // Looks up n mappings and returns the number found.  Containers
+  // which can overlap independent lookups override this.
+  virtual std::size_t find_batch(MemoryMapping *mms, std::size_t n) {
+    std::size_t found = 0;
+    for(std::size_t i = 0; i < n; ++i)
+      found += static_cast<std::size_t>(end() != find(mms[i]));
+    return found;
+  }
+  // Inserts n mappings, with the same result as inserting them one at
+  // a time in order.  Containers which can build faster from sorted
+  // input override this and sort them once; mms is not reordered.
+  virtual void insert_bulk(MemoryMapping *mms, std::size_t n) {
+    for(std::size_t i = 0; i < n; ++i) insert(mms[i]);
+  }
+};
+
+// Links n mappings into an intrusive tree in address order.  Those
+// above everything in the tree go on its right edge with push_back(),
+// which rebalances in amortized constant time, so that building from
+// empty is linear after the sort.  Sorting is stable, so where two
+// mappings are for the same page the first is kept, as by
+// insert_unique().
+template<class Tree>
+void link_sorted(Tree &t, MemoryMapping *mms, std::size_t n) {
+  std::vector<MemoryMapping*> sorted(n);
+  for(std::size_t i = 0; i < n; ++i) sorted[i] = &mms[i];
+  auto less = [](const MemoryMapping *a, const MemoryMapping *b) {
+    return *a < *b;
+  };
+  if(!std::is_sorted(sorted.begin(), sorted.end(), less))
+    std::stable_sort(sorted.begin(), sorted.end(), less);
+  for(std::size_t i = 0; i < n; ++i) {
+    if(t.empty() || *t.rbegin() < *sorted[i]) t.push_back(*sorted[i]);
+    else t.insert_unique(*sorted[i]);
+  }
+}
+
+class RBTreeContainer : public MemoryContainer<RBTree::iterator> {
+
+  RBTree rbt_;
+
+public:
+  RBTreeContainer() : rbt_() {}
+  void insert(MemoryMapping& mm) { rbt_.insert_unique(mm); }
+  RBTree::iterator end() { return rbt_.end(); }
+  RBTree::iterator find(MemoryMapping& mm) { return rbt_.find(mm); }
+  void clear() { rbt_.clear(); }
+  std::size_t size() { return rbt_.size(); }
+  std::size_t memory_bytes() {
+    return sizeof(RBTree) + rbt_.size() * sizeof(MemoryMapping);
+  }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    RBTree::iterator it = rbt_.find(mm);
+    if(it == rbt_.end()) return NULL;
+    MemoryMapping *held = &*it;
+    rbt_.erase(it);
+    return held;
+  }
+  bool holds_mappings() { return true; }
+  void insert_bulk(MemoryMapping *mms, std::size_t n) {
+    link_sorted(rbt_, mms, n);
+  }
+};
+
+class AVLTreeContainer : public MemoryContainer<AVLTree::iterator> {
+  AVLTree avlt_;
+
+public:
+  AVLTreeContainer() : avlt_() {}
+  void insert(MemoryMapping& mm) {avlt_.insert_unique(mm); }
+  AVLTree::iterator end() { return avlt_.end(); }
+  AVLTree::iterator find(MemoryMapping& mm) { return avlt_.find(mm); }
+  void clear() { avlt_.clear(); }
+  std::size_t size() { return avlt_.size(); }
+  std::size_t memory_bytes() {
+    return sizeof(AVLTree) + avlt_.size() * sizeof(MemoryMapping);
+  }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    AVLTree::iterator it = avlt_.find(mm);
+    if(it == avlt_.end()) return NULL;
+    MemoryMapping *held = &*it;
+    avlt_.erase(it);
+    return held;
+  }
+  bool holds_mappings() { return true; }
+  void insert_bulk(MemoryMapping *mms, std::size_t n) {
+    link_sorted(avlt_, mms, n);
+  }
+};
+
+class SplayTreeContainer : public MemoryContainer<SplayTree::iterator> {
+  SplayTree splayt_;
+
+public:
+  SplayTreeContainer() : splayt_() {}
+  void insert(MemoryMapping& mm) {splayt_.insert_unique(mm); }
+  SplayTree::iterator end() { return splayt_.end(); }
+  SplayTree::iterator find(MemoryMapping& mm) { return splayt_.find(mm); }
+  void clear() { splayt_.clear(); }
+  std::size_t size() { return splayt_.size(); }
+  std::size_t memory_bytes() {
+    return sizeof(SplayTree) + splayt_.size() * sizeof(MemoryMapping);
+  }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    SplayTree::iterator it = splayt_.find(mm);
+    if(it == splayt_.end()) return NULL;
+    MemoryMapping *held = &*it;
+    splayt_.erase(it);
+    return held;
+  }
+  bool holds_mappings() { return true; }
+  void insert_bulk(MemoryMapping *mms, std::size_t n) {
+    link_sorted(splayt_, mms, n);
+  }
+};
+
+class RadixTreeContainer : public MemoryContainer<RadixTreeIterator> {
+  RadixTree radixt_;
+
+public:
+  RadixTreeContainer() : radixt_() {}
+  void insert(MemoryMapping& mm) {radixt_.insert(mm.getVA(), mm.getPA()); }
+  RadixTreeIterator end() { return radixt_.end(); }
+  RadixTreeIterator find(MemoryMapping& mm) {
+    return radixt_.find(mm.getVA());
+  }
+  void clear() { radixt_.clear(); }
+  std::size_t size() { return radixt_.size(); }
+  std::size_t memory_bytes() { return radixt_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    std::size_t before = radixt_.size();
+    radixt_.erase(mm.getVA());
+    return radixt_.size() < before ? &mm : NULL;
+  }
+  // Sorts the pages so that each p1 table is reached once, with a
+  // least-significant-digit radix sort on the 36-bit page number in
+  // three passes of 12 bits, unless they are in order already.  The
+  // sort is stable, so the last mapping for a page wins, as with
+  // insert().
+  void insert_bulk(MemoryMapping *mms, std::size_t n) {
+    typedef std::pair<uint64_t, uint64_t> Page;
+    static const unsigned digit_bits = 12;
+    static const std::size_t buckets = std::size_t(1) << digit_bits;
+    const uint64_t va_mask = (1ULL << 48) - 1;
+    std::vector<Page> pages(n), sorted(n);
+    for(std::size_t i = 0; i < n; ++i)
+      pages[i] = Page(mms[i].getVA(), mms[i].getPA());
+    std::vector<std::size_t> start(buckets);
+    bool ordered = true;
+    for(std::size_t i = 1; i < n && ordered; ++i)
+      ordered = pages[i - 1].first <= pages[i].first;
+    for(unsigned shift = 12; !ordered && shift < 48; shift += digit_bits) {
+      std::fill(start.begin(), start.end(), 0);
+      for(std::size_t i = 0; i < n; ++i)
+        ++start[((pages[i].first & va_mask) >> shift) & (buckets - 1)];
+      std::size_t sum = 0;
+      for(std::size_t b = 0; b < buckets; ++b) {
+        std::size_t count = start[b];
+        start[b] = sum;
+        sum += count;
+      }
+      for(std::size_t i = 0; i < n; ++i) {
+        std::size_t b = ((pages[i].first & va_mask) >> shift) & (buckets - 1);
+        sorted[start[b]++] = pages[i];
+      }
+      pages.swap(sorted);
+    }
+    if(n) radixt_.insert_sorted(&pages[0], n);
+  }
+  std::size_t find_batch(MemoryMapping *mms, std::size_t n) {
+    static const std::size_t chunk = 64;
+    uint64_t vadds[chunk], padds[chunk];
+    std::size_t found = 0;
+    for(std::size_t base = 0; base < n; base += chunk) {
+      std::size_t m = std::min(chunk, n - base);
+      for(std::size_t i = 0; i < m; ++i)
+        vadds[i] = mms[base + i].getVA();
+      found += radixt_.find_batch(vadds, padds, m);
+    }
+    return found;
+  }
+};
+
+class HashedPageTableContainer : public MemoryContainer<RadixTreeIterator> {
+  HashedPageTable hashpt_;
+
+public:
+  HashedPageTableContainer() : hashpt_() {}
+  void insert(MemoryMapping& mm) { hashpt_.insert(mm.getVA(), mm.getPA()); }
+  RadixTreeIterator end() { return hashpt_.end(); }
+  RadixTreeIterator find(MemoryMapping& mm) {
+    return hashpt_.find(mm.getVA());
+  }
+  void clear() { hashpt_.clear(); }
+  std::size_t size() { return hashpt_.size(); }
+  std::size_t memory_bytes() { return hashpt_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    return hashpt_.erase(mm.getVA()) ? &mm : NULL;
+  }
+  void reserve(std::size_t n) { hashpt_.reserve(n); }
+};
+
+class SwissTableContainer : public MemoryContainer<RadixTreeIterator> {
+  SwissTable st_;
+
+public:
+  SwissTableContainer() : st_() {}
+  void insert(MemoryMapping& mm) { st_.insert(mm.getVA(), mm.getPA()); }
+  RadixTreeIterator end() { return st_.end(); }
+  RadixTreeIterator find(MemoryMapping& mm) { return st_.find(mm.getVA()); }
+  void clear() { st_.clear(); }
+  std::size_t size() { return st_.size(); }
+  std::size_t memory_bytes() { return st_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    return st_.erase(mm.getVA()) ? &mm : NULL;
+  }
+  void reserve(std::size_t n) { st_.reserve(n); }
+};
+
+template <unsigned Fanout>
+class BPlusTreeContainer
+  : public MemoryContainer<typename BPlusTree<Fanout>::iterator> {
+  typedef typename BPlusTree<Fanout>::iterator iterator;
+  BPlusTree<Fanout> bplust_;
+
+public:
+  BPlusTreeContainer() : bplust_() {}
+  void insert(MemoryMapping& mm) { bplust_.insert(mm.getVA(), mm.getPA()); }
+  iterator end() { return bplust_.end(); }
+  iterator find(MemoryMapping& mm) { return bplust_.find(mm.getVA()); }
+  void clear() { bplust_.clear(); }
+  std::size_t size() { return bplust_.size(); }
+  std::size_t memory_bytes() { return bplust_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    return bplust_.erase(mm.getVA()) ? &mm : NULL;
+  }
+};
+
+// Stores each mapping as a one-page region, so that the range tree
+// can be compared against the other containers page by page.
+class RangeTreeContainer : public MemoryContainer<RangeTree::iterator> {
+  RangeTree ranget_;
+
+public:
+  RangeTreeContainer() : ranget_() {}
+  void insert(MemoryMapping& mm) {
+    uint64_t start = mm.getVA() & ~(RangeTree::page_size - 1);
+    uint64_t pa = mm.getPA() & ~(RangeTree::page_size - 1);
+    ranget_.map(start, start + RangeTree::page_size, pa,
+                MemoryRegion::READ | MemoryRegion::WRITE);
+  }
+  RangeTree::iterator end() { return ranget_.end(); }
+  RangeTree::iterator find(MemoryMapping& mm) {
+    return ranget_.find(mm.getVA());
+  }
+  void clear() { ranget_.clear(); }
+  std::size_t size() { return ranget_.size(); }
+  std::size_t memory_bytes() { return ranget_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    if(ranget_.find(mm.getVA()) == ranget_.end()) return NULL;
+    uint64_t start = mm.getVA() & ~(RangeTree::page_size - 1);
+    ranget_.unmap(start, start + RangeTree::page_size);
+    return &mm;
+  }
+};
+
+// Stores each mapping as a one-page range, as RangeTreeContainer does.
+class MapleTreeContainer : public MemoryContainer<MapleTree::iterator> {
+  MapleTree maplet_;
+
+public:
+  MapleTreeContainer() : maplet_() {}
+  void insert(MemoryMapping& mm) {
+    uint64_t start = mm.getVA() & ~(MapleTree::page_size - 1);
+    uint64_t pa = mm.getPA() & ~(MapleTree::page_size - 1);
+    maplet_.map(start, start + MapleTree::page_size, pa,
+                MemoryRegion::READ | MemoryRegion::WRITE);
+  }
+  MapleTree::iterator end() { return maplet_.end(); }
+  MapleTree::iterator find(MemoryMapping& mm) {
+    return maplet_.find(mm.getVA());
+  }
+  void clear() { maplet_.clear(); }
+  std::size_t size() { return maplet_.size(); }
+  std::size_t memory_bytes() { return maplet_.memory_bytes(); }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    if(maplet_.find(mm.getVA()) == maplet_.end()) return NULL;
+    uint64_t start = mm.getVA() & ~(MapleTree::page_size - 1);
+    maplet_.unmap(start, start + MapleTree::page_size);
+    return &mm;
+  }
+};
+
+/******************************************************************************\
+ * Translation Cache.  A mock-up of a set-associative TLB which can be
+ * placed in front of any MemoryContainer.  Entries are tagged with the
+ * full virtual address looked up, and the set is chosen by the low
+ * bits of its page number, so that every entry for a page shares a
+ * set.  Only successful lookups are cached.  Inserting a mapping
+ * invalidates any cached entries for its page, and clearing the
+ * container flushes the whole cache, so that a find through the cache
+ * always agrees with the container behind it.
+ *
+ * One cache may be shared by several address spaces, each a container
+ * with an address-space ID, as a CPU's TLB is shared by the processes
+ * it runs.  switch_to() makes another space current.  With ASID_TAGGED
+ * entries also carry the ASID they were filled under and only match
+ * lookups in that space, so entries survive a switch; with
+ * FLUSH_ON_SWITCH every switch to another space flushes the cache.
+ * Inserts, erases and clear() act on the current space and drop only
+ * its entries.
+\******************************************************************************/
+
+enum ReplacementPolicy { LRU, FIFO, RANDOM };
+enum SwitchPolicy { ASID_TAGGED, FLUSH_ON_SWITCH };
+
+template<class Iterator>
+class TranslationCache : public MemoryContainer<Iterator> {
+  struct Entry {
+    bool valid;
+    uint32_t asid;
+    uint64_t va;
+    uint64_t stamp;
+    Iterator it;
+    Entry(Iterator i) : valid(false), asid(0), va(0), stamp(0), it(i) {}
+  };
+
+  MemoryContainer<Iterator> *c_;   // The current address space
+  uint32_t asid_;
+  SwitchPolicy switching_;
+  std::size_t sets_, ways_;
+  ReplacementPolicy policy_;
+  std::vector<Entry> entries_;
+  uint64_t clock_, rand_;
+  std::size_t hits_, misses_, evictions_, switches_;
+
+  Entry *set_of(uint64_t va) {
+    return &entries_[((va >> 12) & (sets_ - 1)) * ways_];
+  }
+
+  // Chooses the way to fill in the given set: an invalid way if there
+  // is one, and otherwise the victim chosen by the policy.
+  Entry *victim(Entry *set) {
+    Entry *v = set;
+    for(std::size_t w = 0; w < ways_; ++w) {
+      if(!set[w].valid) return &set[w];
+      if(set[w].stamp < v->stamp) v = &set[w];
+    }
+    if(policy_ == RANDOM) {
+      // xorshift64
+      rand_ ^= rand_ << 13;
+      rand_ ^= rand_ >> 7;
+      rand_ ^= rand_ << 17;
+      v = &set[rand_ % ways_];
+    }
+    ++evictions_;
+    return v;
+  }
+
+public:
+  // A cache in front of c, the address space with ASID 0.
+  TranslationCache(MemoryContainer<Iterator> &c, std::size_t sets,
+                   std::size_t ways, ReplacementPolicy policy,
+                   SwitchPolicy switching = ASID_TAGGED) :
+    c_(&c), asid_(0), switching_(switching), sets_(sets), ways_(ways),
+    policy_(policy), entries_(sets * ways, Entry(c.end())), clock_(0),
+    rand_(0x9e3779b97f4a7c15ULL), hits_(0), misses_(0), evictions_(0),
+    switches_(0) {
+    assert(sets > 0 && (sets & (sets - 1)) == 0);
+    assert(ways > 0);
+  }
+
+  // Makes c, with the given ASID, the current address space.  Every
+  // container must have the same end().
+  void switch_to(MemoryContainer<Iterator> &c, uint32_t asid) {
+    if(asid == asid_ && &c == c_) return;
+    if(switching_ == FLUSH_ON_SWITCH) flush();
+    c_ = &c;
+    asid_ = asid;
+    ++switches_;
+  }
+  uint32_t asid() { return asid_; }
+
+  void insert(MemoryMapping& mm) {
+    invalidate(mm.getVA());
+    c_->insert(mm);
+  }
+  Iterator end() { return c_->end(); }
+  Iterator find(MemoryMapping& mm) {
+    uint64_t va = mm.getVA();
+    Entry *set = set_of(va);
+    ++clock_;
+    for(std::size_t w = 0; w < ways_; ++w) {
+      if(set[w].valid && set[w].va == va && set[w].asid == asid_) {
+        ++hits_;
+        if(policy_ == LRU) set[w].stamp = clock_;
+        return set[w].it;
+      }
+    }
+    ++misses_;
+    Iterator it = c_->find(mm);
+    if(it != c_->end()) {
+      Entry *e = victim(set);
+      e->valid = true;
+      e->asid = asid_;
+      e->va = va;
+      e->stamp = clock_;
+      e->it = it;
+    }
+    return it;
+  }
+  void clear() {
+    flush_asid(asid_);
+    c_->clear();
+  }
+  std::size_t size() { return c_->size(); }
+  std::size_t memory_bytes() {
+    return sizeof(*this) + entries_.capacity() * sizeof(Entry) +
+      c_->memory_bytes();
+  }
+  MemoryMapping *erase(MemoryMapping& mm) {
+    invalidate(mm.getVA());
+    return c_->erase(mm);
+  }
+  bool holds_mappings() { return c_->holds_mappings(); }
+
+  // Drops any cached entries of the current space for the page
+  // containing va.
+  void invalidate(uint64_t va) {
+    Entry *set = set_of(va);
+    for(std::size_t w = 0; w < ways_; ++w) {
+      if((set[w].va >> 12) == (va >> 12) && set[w].asid == asid_)
+        set[w].valid = false;
+    }
+  }
+  void flush() {
+    for(std::size_t i = 0; i < entries_.size(); ++i)
+      entries_[i].valid = false;
+  }
+  // Drops every cached entry of one address space.
+  void flush_asid(uint32_t asid) {
+    for(std::size_t i = 0; i < entries_.size(); ++i)
+      if(entries_[i].asid == asid) entries_[i].valid = false;
+  }
+
+  std::size_t hits() { return hits_; }
+  std::size_t misses() { return misses_; }
+  std::size_t evictions() { return evictions_; }
+  std::size_t switches() { return switches_; }
+  void reset_counters() { hits_ = misses_ = evictions_ = switches_ = 0; }
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,186 @@
+#ifndef HASHED_PAGETABLE_HPP
+#define HASHED_PAGETABLE_HPP
+/******************************************************************************\
+ * Hashed Page Table
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Hashed Page Table.  A mock-up of the PowerPC hashed page table: an
+ * open-addressed table of page table entry groups (PTEGs), each of
+ * eight 16-byte entries, 128 bytes in all.  Each entry holds the
+ * virtual page number it maps as a tag, alongside the physical frame.
+ *
+ * A page is stored in its primary group, chosen by hashing its page
+ * number, or failing that in its secondary group, the one's
+ * complement of the primary hash.  A lookup therefore reads one group
+ * in the common case and never more than two, and an erase simply
+ * clears its entry, as no probe sequence runs through it.
+ *
+ * The table is sized to the number of mapped pages rather than to the
+ * virtual address space: it holds at most two entries per mapped page
+ * and so uses the same memory however scattered the pages are.  Where
+ * the hardware would evict an entry when both groups are full, this
+ * table doubles instead, so that no mapping is ever lost.
+\******************************************************************************/
+
+class HashedPageTable {
+  static const unsigned page_shift = 12;
+  static const size_t group_size = 8;
+  static const size_t min_groups = 8;
+  static const uint64_t VALID = 1;
+
+  struct Entry {
+    uint64_t tag;   // vpn << 1 | VALID, or 0 if free
+    uint64_t pa;    // Physical address of the page
+  };
+
+  struct Group {
+    Entry e[group_size];
+  };
+
+  Group *g_;
+  size_t groups_;     // Always a power of two
+  size_t s_;
+  size_t reserved_;   // Groups kept by clear()
+
+  static uint64_t vpn(uint64_t vadd) {
+    return (vadd & ((1ULL << 48) - 1)) >> page_shift;
+  }
+
+  size_t primary(uint64_t vpn) const {
+    // Fibonacci hashing, as the hardware's XOR of the VSID and page
+    // index would cluster the pages of a single address space.
+    return size_t((vpn * 0x9e3779b97f4a7c15ULL) >> 32) & (groups_ - 1);
+  }
+
+  size_t secondary(size_t h) const { return ~h & (groups_ - 1); }
+
+  static Group *alloc_groups(size_t n) {
+    void *p = NULL;
+    if(posix_memalign(&p, 64, n * sizeof(Group)) != 0)
+      throw std::bad_alloc();
+    memset(p, 0, n * sizeof(Group));
+    return static_cast<Group*>(p);
+  }
+
+  static Entry *match(Group &g, uint64_t tag) {
+    for(size_t i = 0; i < group_size; ++i)
+      if(g.e[i].tag == tag) return &g.e[i];
+    return NULL;
+  }
+
+  // Resizes to n groups, rehashing every entry.
+  void rehash(size_t n) {
+    Group *old = g_;
+    size_t oldGroups = groups_;
+    for(;;) {
+      g_ = alloc_groups(n);
+      groups_ = n;
+      bool fits = true;
+      for(size_t i = 0; fits && i < oldGroups; ++i) {
+        for(size_t j = 0; fits && j < group_size; ++j) {
+          const Entry &e = old[i].e[j];
+          if(e.tag & VALID) fits = place(e.tag, e.pa);
+        }
+      }
+      if(fits) break;
+      ::free(g_);
+      n *= 2;
+    }
+    ::free(old);
+  }
+
+  // Puts a new entry in a free slot of its primary or secondary
+  // group, returning false if both are full.
+  bool place(uint64_t tag, uint64_t pa) {
+    size_t h = primary(tag >> 1);
+    Entry *e = match(g_[h], 0);
+    if(e == NULL) e = match(g_[secondary(h)], 0);
+    if(e == NULL) return false;
+    e->tag = tag;
+    e->pa = pa;
+    return true;
+  }
+
+  Entry *lookup(uint64_t vadd) {
+    uint64_t tag = (vpn(vadd) << 1) | VALID;
+    size_t h = primary(tag >> 1);
+    Entry *e = match(g_[h], tag);
+    return e != NULL ? e : match(g_[secondary(h)], tag);
+  }
+
+public:
+  HashedPageTable() : g_(alloc_groups(min_groups)), groups_(min_groups),
+                      s_(0), reserved_(min_groups) {}
+  HashedPageTable(const HashedPageTable&) = delete;
+  HashedPageTable& operator=(const HashedPageTable&) = delete;
+  ~HashedPageTable() { ::free(g_); }
+
+  // Sizes the table for n mapped pages, now and after every clear().
+  void reserve(size_t n) {
+    size_t groups = min_groups;
+    while(groups * group_size < 2 * n) groups *= 2;
+    reserved_ = groups;
+    if(groups > groups_) rehash(groups);
+  }
+
+  void insert(uint64_t vadd, uint64_t padd) {
+    uint64_t pa = padd & ~((1ULL << page_shift) - 1);
+    Entry *e = lookup(vadd);
+    if(e != NULL) {
+      e->pa = pa;
+      return;
+    }
+    // Keep the table at most half full, so that nearly every page
+    // fits in its primary group.
+    if(2 * (s_ + 1) > groups_ * group_size) rehash(groups_ * 2);
+    uint64_t tag = (vpn(vadd) << 1) | VALID;
+    while(!place(tag, pa)) rehash(groups_ * 2);
+    ++s_;
+  }
+
+  // Removes the page containing vadd, returning whether it was mapped.
+  bool erase(uint64_t vadd) {
+    Entry *e = lookup(vadd);
+    if(e == NULL) return false;
+    e->tag = 0;
+    --s_;
+    return true;
+  }
+
+  RadixTreeIterator find(uint64_t vadd) {
+    Entry *e = lookup(vadd);
+    if(e == NULL) return end();
+    return RadixTreeIterator(vadd,
+                             e->pa | (vadd & ((1ULL << page_shift) - 1)));
+  }
+
+  RadixTreeIterator end() { return RadixTreeIterator(-1, -1, true); }
+
+  // Empties the table, shrinking it back to the reserved size.
+  void clear() {
+    s_ = 0;
+    if(groups_ != reserved_) {
+      ::free(g_);
+      g_ = alloc_groups(reserved_);
+      groups_ = reserved_;
+    } else {
+      memset(g_, 0, groups_ * sizeof(Group));
+    }
+  }
+
+  size_t size() { return s_; }
+  size_t groups() { return groups_; }
+  size_t memory_bytes() { return sizeof(*this) + groups_ * sizeof(Group); }
+};
+
+/******************************************************************************/
+#endif
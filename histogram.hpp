@@ -0,0 +1,106 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+/******************************************************************************\
+ * Latency Histogram
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/******************************************************************************\
+ * Latency Histogram.  A log-linear histogram in the style of
+ * HdrHistogram: values below 2^SubBits each have a bucket of their
+ * own, and above that every power of two is split into 2^SubBits
+ * equal buckets, so every value is recorded to within a relative
+ * error of 2^-SubBits (about 3% for the default of 5) whatever its
+ * magnitude.  Recording is a count-leading-zeros, a shift and an
+ * increment, with no allocation.
+ *
+ * Values are latencies in nanoseconds, kept internally in picoseconds
+ * so that latencies averaged over a small batch keep their fraction.
+\******************************************************************************/
+
+template <unsigned SubBits = 5>
+class LatencyHistogram {
+  static const uint64_t sub_count = uint64_t(1) << SubBits;
+  static const std::size_t num_buckets = (64 - SubBits + 1) * sub_count;
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+  uint64_t min_, max_;
+  double sum_;
+
+  static std::size_t index(uint64_t v) {
+    if(v < sub_count) return std::size_t(v);
+    unsigned shift = 63 - __builtin_clzll(v) - SubBits;
+    return std::size_t((shift + 1) * sub_count + ((v >> shift) - sub_count));
+  }
+
+  // The smallest and largest values recorded in bucket i.
+  static uint64_t lowest(std::size_t i) {
+    if(i < sub_count) return i;
+    unsigned shift = unsigned(i / sub_count) - 1;
+    return (sub_count + i % sub_count) << shift;
+  }
+  static uint64_t highest(std::size_t i) {
+    if(i < sub_count) return i;
+    unsigned shift = unsigned(i / sub_count) - 1;
+    return lowest(i) + ((uint64_t(1) << shift) - 1);
+  }
+
+public:
+  LatencyHistogram() : counts_(num_buckets, 0) { reset(); }
+
+  void reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+    sum_ = 0.0;
+  }
+
+  // Records count operations which each took ns nanoseconds.
+  void record(double ns, uint64_t count = 1) {
+    uint64_t ps = ns <= 0.0 ? 0 : uint64_t(ns * 1000.0 + 0.5);
+    counts_[index(ps)] += count;
+    total_ += count;
+    if(ps < min_) min_ = ps;
+    if(ps > max_) max_ = ps;
+    sum_ += double(ps) * count;
+  }
+
+  uint64_t count() const { return total_; }
+  double min() const { return total_ ? min_ / 1000.0 : 0.0; }
+  double max() const { return max_ / 1000.0; }
+  double mean() const { return total_ ? sum_ / total_ / 1000.0 : 0.0; }
+
+  // The latency below which the fraction q of operations fall, to
+  // within the precision of the buckets.
+  double percentile(double q) const {
+    if(total_ == 0) return 0.0;
+    if(q >= 1.0) return max();
+    uint64_t rank = uint64_t(std::ceil(q * total_));
+    if(rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for(std::size_t i = 0; i < num_buckets; ++i) {
+      seen += counts_[i];
+      if(seen >= rank) {
+        // The middle of the bucket, but never outside what was seen
+        uint64_t v = lowest(i) + (highest(i) - lowest(i)) / 2;
+        if(v < min_) v = min_;
+        if(v > max_) v = max_;
+        return v / 1000.0;
+      }
+    }
+    return max();
+  }
+};
+
+/******************************************************************************/
+#endif
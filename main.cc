@@ -5,239 +5,886 @@
  * http://www.boost.org/doc/libs/1_60_0/doc/html/intrusive/avl_set_multiset.html
 \******************************************************************************/
 
-#include <boost/intrusive/rbtree.hpp>
-#include <boost/intrusive/avltree.hpp>
-#include <boost/intrusive/splaytree.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
 #include <vector>
 #include <functional>
 #include <cassert>
 #include <random>
 #include <cstdint>
-#include "radixtree.hpp"
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <deque>
+#include <cstring>
+#include <memory>
+#include "containers.hpp"
+#include "concurrent_radixtree.hpp"
+#include "workload.hpp"
+#include "trace.hpp"
+#include "bench.hpp"
 
-using namespace boost::intrusive;
-using namespace boost::posix_time;
-
-/******************************************************************************/
+/******************************************************************************\
+ * Inserts every value into the container and looks up every lookup,
+ * then looks them up again in one batch, and reports the memory used
+ * per mapping.
+\******************************************************************************/
 
-class MemoryMapping : public set_base_hook<optimize_size<false> >,
-                      public avl_set_base_hook<optimize_size<false> >,
-                      public bs_set_base_hook<optimize_size<false> >
-{
-  std::uint64_t va_;
-  std::uint64_t pa_;
+template<class Iterator>
+void test_insertion(MemoryContainer<Iterator> &c,
+                    const char *ContainerName,
+                    std::vector<MemoryMapping> &values,
+                    std::vector<MemoryMapping> &lookups,
+                    const BenchOptions &o,
+                    Reporter &report) {
+  bench_insert_search(report, o, ContainerName, values.size(), lookups.size(),
+                      [&]() { c.clear(); },
+                      [&](std::size_t i) { c.insert(values[i]); },
+                      [&](std::size_t i) {
+                        return c.end() != c.find(lookups[i]);
+                      });
+  if(c.size() != values.size()){
+    std::cerr << "    ERROR: size not consistent" << std::endl;
+  }
+  report.value(ContainerName, "bytes-per-mapping", values.size(), "bytes",
+               double(c.memory_bytes()) / double(values.size()));
+  // Batched search
+  std::size_t found = 0;
+  report.row(ContainerName, "search-batch", values.size(), "ns/op",
+             measure(o, lookups.size(), [&]() { found = 0; }, [&]() {
+                 found = c.find_batch(&lookups[0], lookups.size());
+               }));
+  if(found != lookups.size()){
+    std::cerr << "    ERROR: not all found, "
+              << found << " found out of " << lookups.size()
+              << std::endl;
+  }
+  c.clear();
+}
 
-public:
-  set_member_hook<> member_hook_;
+/******************************************************************************\
+ * Builds the container from every value one insert at a time and then
+ * with a single insert_bulk(), and reports the time per mapping of
+ * each and the speed-up of the bulk load.  The values are inserted in
+ * the order given, which is the workload's insert order.
+\******************************************************************************/
 
-  MemoryMapping(uint64_t va, uint64_t pa) : va_(va), pa_(pa) {}
+template<class Iterator>
+void test_bulk_insertion(MemoryContainer<Iterator> &c,
+                         const char *ContainerName,
+                         std::vector<MemoryMapping> &values,
+                         std::vector<MemoryMapping> &lookups,
+                         const BenchOptions &o,
+                         Reporter &report) {
+  const std::size_t n = values.size();
+  Samples single = measure(o, n, [&]() { c.clear(); }, [&]() {
+      for(std::size_t i = 0; i != n; ++i) c.insert(values[i]);
+    });
+  Samples bulk = measure(o, n, [&]() { c.clear(); }, [&]() {
+      c.insert_bulk(&values[0], n);
+    });
+  report.row(ContainerName, "insert-bulk", n, "ns/op", bulk);
+  report.value(ContainerName, "bulk-speedup", n, "ratio",
+               Stats(single.ns).median() / Stats(bulk.ns).median());
+  std::size_t found = c.find_batch(&lookups[0], lookups.size());
+  if(c.size() != n || found != lookups.size()) {
+    std::cerr << "    ERROR: bulk load holds " << c.size() << " of " << n
+              << " and found " << found << " of " << lookups.size()
+              << std::endl;
+  }
+  c.clear();
+}
 
-  std::uint64_t getVA() { return va_; }
-  std::uint64_t getPA() { return pa_; }
+/******************************************************************************\
+ * Region workload.  Real processes map, protect and unmap whole
+ * regions rather than individual pages.  The range and maple trees
+ * handle each region with a constant number of tree operations,
+ * whereas the per-page trees must insert and erase one MemoryMapping
+ * per page, so all times below are reported per region (or per
+ * lookup).
+\******************************************************************************/
 
-  friend bool operator< (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ < b.va_; }
-  friend bool operator> (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ > b.va_; }
-  friend bool operator== (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ == b.va_; }  
+struct Region {
+  uint64_t start, end, pa;
+  std::size_t firstPage, numPages;
 };
 
-// Define trees using the base hook
-typedef rbtree<    MemoryMapping, compare<std::less<MemoryMapping> > >     RBTree;
-typedef avltree<   MemoryMapping, compare<std::less<MemoryMapping> > >     AVLTree;
-typedef splaytree< MemoryMapping, compare<std::less<MemoryMapping> > >     SplayTree;
-
-/******************************************************************************/
+template<class Tree>
+void test_regions(Tree &rt,
+                  const char *ContainerName,
+                  std::vector<Region> &regions,
+                  std::vector<MemoryMapping> &lookups,
+                  const BenchOptions &o,
+                  Reporter &report) {
+  const uint8_t rw = MemoryRegion::READ | MemoryRegion::WRITE;
+  const std::size_t n = regions.size();
+  auto map_all = [&]() {
+    for(std::size_t i = 0; i != n; ++i) {
+      rt.map(regions[i].start, regions[i].end, regions[i].pa, rw);
+    }
+  };
+  // Map
+  report.row(ContainerName, "region-map", n, "ns/region",
+             measure(o, n, [&]() { rt.clear(); }, map_all));
+  if(rt.size() != n) {
+    std::cerr << "    ERROR: size not consistent" << std::endl;
+  }
+  // Search
+  std::size_t found = 0;
+  report.row(ContainerName, "region-search", n, "ns/op",
+             measure(o, lookups.size(), [&]() { found = 0; }, [&]() {
+                 for(std::size_t i = 0, max = lookups.size(); i != max; ++i) {
+                   found += static_cast<std::size_t>(
+                     rt.end() != rt.find(lookups[i].getVA()));
+                 }
+               }));
+  if(found != lookups.size()) {
+    std::cerr << "    ERROR: not all found, "
+              << found << " found out of " << lookups.size()
+              << std::endl;
+  }
+  // Protect the middle of each region read-only, which splits it in
+  // three, then make it writable again, which merges it back.
+  report.row(ContainerName, "region-protect", n, "ns/region",
+             measure(o, n, []() {}, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   uint64_t quarter =
+                     (regions[i].numPages / 4) * RangeTree::page_size;
+                   rt.protect(regions[i].start + quarter,
+                              regions[i].end - quarter, MemoryRegion::READ);
+                   rt.protect(regions[i].start + quarter,
+                              regions[i].end - quarter, rw);
+                 }
+               }));
+  if(rt.size() != n) {
+    std::cerr << "    ERROR: regions not merged after protect" << std::endl;
+  }
+  // Unmap
+  report.row(ContainerName, "region-unmap", n, "ns/region",
+             measure(o, n, [&]() { rt.clear(); map_all(); }, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   rt.unmap(regions[i].start, regions[i].end);
+                 }
+               }));
+  if(rt.size() != 0) {
+    std::cerr << "    ERROR: regions left after unmap" << std::endl;
+  }
+  rt.clear();
+}
 
-template<class Iterator>
-class MemoryContainer {
-public:
-  virtual void insert(MemoryMapping&) = 0;
-  virtual Iterator end() = 0;
-  virtual Iterator find(MemoryMapping&) = 0;
-  virtual void clear() = 0;
-  virtual std::size_t size() = 0;
-};
+// The same workload against a tree of per-page mappings.  Each
+// region costs one insert or erase per page.
+template<class Tree>
+void test_regions_paged(Tree &t,
+                        const char *ContainerName,
+                        std::vector<Region> &regions,
+                        std::vector<MemoryMapping> &pages,
+                        std::vector<MemoryMapping> &lookups,
+                        const BenchOptions &o,
+                        Reporter &report) {
+  const std::size_t n = regions.size();
+  // Map
+  report.row(ContainerName, "region-map", n, "ns/region",
+             measure(o, n, [&]() { t.clear(); }, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   for(std::size_t p = regions[i].firstPage,
+                         pmax = p + regions[i].numPages
+                         ; p != pmax
+                         ; ++p) {
+                     t.insert_unique(pages[p]);
+                   }
+                 }
+               }));
+  if(t.size() != pages.size()) {
+    std::cerr << "    ERROR: size not consistent" << std::endl;
+  }
+  // Search
+  std::size_t found = 0;
+  report.row(ContainerName, "region-search", n, "ns/op",
+             measure(o, lookups.size(), [&]() { found = 0; }, [&]() {
+                 for(std::size_t i = 0, max = lookups.size(); i != max; ++i) {
+                   found += static_cast<std::size_t>(t.end() !=
+                                                     t.find(lookups[i]));
+                 }
+               }));
+  if(found != lookups.size()) {
+    std::cerr << "    ERROR: not all found, "
+              << found << " found out of " << lookups.size()
+              << std::endl;
+  }
+  // Unmap
+  auto insert_all = [&]() {
+    t.clear();
+    for(std::size_t p = 0, pmax = pages.size(); p != pmax; ++p) {
+      t.insert_unique(pages[p]);
+    }
+  };
+  report.row(ContainerName, "region-unmap", n, "ns/region",
+             measure(o, n, insert_all, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   for(std::size_t p = regions[i].firstPage,
+                         pmax = p + regions[i].numPages
+                         ; p != pmax
+                         ; ++p) {
+                     t.erase(pages[p]);
+                   }
+                 }
+               }));
+  if(t.size() != 0) {
+    std::cerr << "    ERROR: pages left after unmap" << std::endl;
+  }
+  t.clear();
+}
 
-class RBTreeContainer : public MemoryContainer<RBTree::iterator> {
+/******************************************************************************\
+ * Ordered scans.  From each lookup address, visits the mappings at and
+ * above it in order, as a walk over a range of the address space
+ * would.  The binary tree follows parent and child pointers from node
+ * to node; the B+ tree walks along its leaves.
+\******************************************************************************/
 
-  RBTree rbt_;
+void test_scans(std::vector<MemoryMapping> &values,
+                std::vector<MemoryMapping> &lookups,
+                const BenchOptions &o,
+                Reporter &report) {
+  const std::size_t length = 16;
+  const std::size_t n = lookups.size();
+  RBTree rbt;
+  BPlusTree<16> bplust;
+  for(std::size_t i = 0, max = values.size(); i != max; ++i) {
+    rbt.insert_unique(values[i]);
+    bplust.insert(values[i].getVA(), values[i].getPA());
+  }
+  // Sums of the physical addresses visited, which must agree
+  uint64_t rbSum = 0, bplusSum = 0;
+  report.row("Red-Black Tree", "scan-16", values.size(), "ns/scan",
+             measure(o, n, [&]() { rbSum = 0; }, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   RBTree::iterator it = rbt.lower_bound(lookups[i]);
+                   for(std::size_t j = 0; j != length && it != rbt.end();
+                       ++j, ++it) {
+                     rbSum += it->getPA();
+                   }
+                 }
+               }));
+  report.row("B+ Tree (16)", "scan-16", values.size(), "ns/scan",
+             measure(o, n, [&]() { bplusSum = 0; }, [&]() {
+                 for(std::size_t i = 0; i != n; ++i) {
+                   BPlusTree<16>::iterator it =
+                     bplust.lower_bound(lookups[i].getVA());
+                   for(std::size_t j = 0; j != length && it != bplust.end();
+                       ++j, ++it) {
+                     bplusSum += *it;
+                   }
+                 }
+               }));
+  if(rbSum != bplusSum) {
+    std::cerr << "    ERROR: scans visited different mappings" << std::endl;
+  }
+  rbt.clear();
+}
 
-public:
-  RBTreeContainer() : rbt_() {}
-  void insert(MemoryMapping& mm) { rbt_.insert_unique(mm); }
-  RBTree::iterator end() { return rbt_.end(); }
-  RBTree::iterator find(MemoryMapping& mm) { return rbt_.find(mm); }
-  void clear() { rbt_.clear(); }
-  std::size_t size() { return rbt_.size(); }
-};
+/******************************************************************************\
+ * Lookups with temporal locality, through a container with or without
+ * a translation cache in front of it.  The container is filled once,
+ * untimed, and then searched for each of the lookups in order.
+\******************************************************************************/
 
-class AVLTreeContainer : public MemoryContainer<AVLTree::iterator> {
-  AVLTree avlt_;
+template<class Iterator>
+void test_lookups(MemoryContainer<Iterator> &c,
+                  const char *ContainerName,
+                  std::vector<MemoryMapping> &values,
+                  std::vector<MemoryMapping> &lookups,
+                  const BenchOptions &o,
+                  Reporter &report) {
+  c.clear();
+  for(std::size_t i = 0, max = values.size(); i != max; ++i) {
+    c.insert(values[i]);
+  }
+  std::size_t found = 0;
+  report.row(ContainerName, "local-search", values.size(), "ns/op",
+             measure(o, lookups.size(), [&]() { found = 0; }, [&]() {
+                 for(std::size_t i = 0, max = lookups.size(); i != max; ++i) {
+                   found += static_cast<std::size_t>(c.end() !=
+                                                     c.find(lookups[i]));
+                 }
+               }));
+  if(found != lookups.size()) {
+    std::cerr << "    ERROR: not all found, "
+              << found << " found out of " << lookups.size()
+              << std::endl;
+  }
+  c.clear();
+}
 
-public:
-  AVLTreeContainer() : avlt_() {}
-  void insert(MemoryMapping& mm) {avlt_.insert_unique(mm); }
-  AVLTree::iterator end() { return avlt_.end(); }
-  AVLTree::iterator find(MemoryMapping& mm) { return avlt_.find(mm); }
-  void clear() { avlt_.clear(); }
-  std::size_t size() { return avlt_.size(); }
-};
+// Runs test_lookups through a translation cache and reports its
+// counters, totalled over all runs including the warmup.
+template<class Iterator>
+void test_cache(TranslationCache<Iterator> &tlb,
+                const char *ContainerName,
+                std::vector<MemoryMapping> &values,
+                std::vector<MemoryMapping> &lookups,
+                const BenchOptions &o,
+                Reporter &report) {
+  tlb.reset_counters();
+  test_lookups(tlb, ContainerName, values, lookups, o, report);
+  std::size_t total = tlb.hits() + tlb.misses();
+  std::size_t n = values.size();
+  report.value(ContainerName, "tlb-hits", n, "count", tlb.hits());
+  report.value(ContainerName, "tlb-misses", n, "count", tlb.misses());
+  report.value(ContainerName, "tlb-evictions", n, "count", tlb.evictions());
+  report.value(ContainerName, "tlb-hit-rate", n, "ratio",
+               total ? double(tlb.hits()) / double(total) : 0.0);
+}
 
-class SplayTreeContainer : public MemoryContainer<SplayTree::iterator> {
-  SplayTree splayt_;
+/******************************************************************************\
+ * Many address spaces behind one translation cache.  numSpaces radix
+ * trees each map the virtual addresses of values, as forked processes
+ * would, but to frames of their own.  A round-robin scheduler runs
+ * each space for quantum lookups at a time through a shared 64x4 LRU
+ * cache, each space taking up its stream of lookups where it left
+ * off.  Reports the time per lookup and the hit rate with ASID-tagged
+ * entries and with a flush on every switch.
+\******************************************************************************/
 
-public:
-  SplayTreeContainer() : splayt_() {}
-  void insert(MemoryMapping& mm) {splayt_.insert_unique(mm); }
-  SplayTree::iterator end() { return splayt_.end(); }
-  SplayTree::iterator find(MemoryMapping& mm) { return splayt_.find(mm); }
-  void clear() { splayt_.clear(); }
-  std::size_t size() { return splayt_.size(); }
-};
+void test_address_spaces(std::vector<MemoryMapping> &values,
+                         std::vector<MemoryMapping> &lookups,
+                         std::size_t numSpaces,
+                         std::size_t quantum,
+                         const BenchOptions &o,
+                         Reporter &report) {
+  std::vector<std::unique_ptr<RadixTreeContainer> > spaces;
+  for(std::size_t s = 0; s < numSpaces; ++s) {
+    spaces.push_back(std::unique_ptr<RadixTreeContainer>(
+                       new RadixTreeContainer()));
+    for(std::size_t i = 0, max = values.size(); i != max; ++i) {
+      MemoryMapping mm(values[i].getVA(), values[i].getPA() ^ (s << 12));
+      spaces[s]->insert(mm);
+    }
+  }
+  const std::size_t n = values.size() * numSpaces;
+  const std::size_t total = lookups.size();
+  const SwitchPolicy policies[] = { ASID_TAGGED, FLUSH_ON_SWITCH };
+  for(SwitchPolicy policy : policies) {
+    std::ostringstream name, op;
+    name << "Address Spaces(" << numSpaces << ")+TLB(64x4 "
+         << (policy == ASID_TAGGED ? "ASID" : "flush") << ")";
+    op << "search-q" << quantum;
+    TranslationCache<RadixTreeIterator> tlb(*spaces[0], 64, 4, LRU, policy);
+    std::size_t found = 0;
+    report.row(name.str(), op.str(), n, "ns/op",
+               measure(o, total, [&]() {
+                   found = 0;
+                   tlb.switch_to(*spaces[0], 0);
+                   tlb.flush();
+                   tlb.reset_counters();
+                 }, [&]() {
+                   for(std::size_t i = 0; i != total; ++i) {
+                     // The space running, and its own count of lookups
+                     std::size_t s = (i / quantum) % numSpaces;
+                     std::size_t j = i / (quantum * numSpaces) * quantum +
+                       i % quantum;
+                     tlb.switch_to(*spaces[s], s);
+                     found += *tlb.find(lookups[j]) ==
+                       (lookups[j].getPA() ^ (s << 12));
+                   }
+                 }));
+    if(found != total) {
+      std::cerr << "    ERROR: " << name.str() << " translated " << found
+                << " of " << total << std::endl;
+    }
+    std::size_t lookupsCounted = tlb.hits() + tlb.misses();
+    report.value(name.str(), "tlb-hit-rate-q" + std::to_string(quantum), n,
+                 "ratio", lookupsCounted ?
+                 double(tlb.hits()) / double(lookupsCounted) : 0.0);
+    report.value(name.str(), "switches-q" + std::to_string(quantum), n,
+                 "count", tlb.switches());
+  }
+}
 
-class RadixTreeContainer : public MemoryContainer<RadixTreeIterator> {
-  RadixTree radixt_;
+/******************************************************************************\
+ * Multi-threaded lookups.  The concurrent radix tree is filled with
+ * values, then numReaders threads each search it for every value,
+ * while numWriters threads repeatedly insert and erase the mappings
+ * in churn.  Reports the total throughput of the readers, in millions
+ * of lookups per second.
+\******************************************************************************/
 
-public:
-  RadixTreeContainer() : radixt_() {}
-  void insert(MemoryMapping& mm) {radixt_.insert(mm.getVA(), mm.getPA()); }
-  RadixTreeIterator end() { return radixt_.end(); }
-  RadixTreeIterator find(MemoryMapping& mm) {
-    return radixt_.find(mm.getVA());
+void test_concurrent(std::vector<MemoryMapping> &values,
+                     std::vector<MemoryMapping> &churn,
+                     std::size_t numReaders,
+                     std::size_t numWriters,
+                     const BenchOptions &o,
+                     Reporter &report) {
+  std::vector<double> times;
+  ConcurrentRadixTree crt;
+  for(std::size_t i = 0, max = values.size(); i != max; ++i) {
+    crt.insert(values[i].getVA(), values[i].getPA());
   }
-  void clear() { radixt_.clear(); }
-  std::size_t size() { return radixt_.size(); }
-};
+  for(std::size_t repeat = 0; repeat != o.warmup + o.repeats; ++repeat) {
+    std::atomic<bool> stop(false);
+    std::atomic<std::size_t> found(0);
+    std::vector<std::thread> writers, readers;
+    for(std::size_t w = 0; w < numWriters; ++w) {
+      writers.push_back(std::thread([&, w]() {
+        std::size_t i = w;
+        while(!stop.load(std::memory_order_relaxed)) {
+          MemoryMapping &mm = churn[i % churn.size()];
+          if(crt.find(mm.getVA()).isValid()) crt.erase(mm.getVA());
+          else crt.insert(mm.getVA(), mm.getPA());
+          i += numWriters;
+        }
+      }));
+    }
+    // Readers wait for go, so that starting and joining threads is not
+    // timed, and the last one to finish stops the clock.
+    std::atomic<bool> go(false);
+    std::atomic<std::size_t> running(numReaders);
+    bench_clock::time_point tini, tend;
+    for(std::size_t r = 0; r < numReaders; ++r) {
+      readers.push_back(std::thread([&, r]() {
+        std::size_t n = values.size(), mine = 0;
+        while(!go.load(std::memory_order_acquire)) {}
+        for(std::size_t i = 0, j = r * (n / numReaders); i != n; ++i) {
+          mine += static_cast<std::size_t>(crt.find(values[j].getVA())
+                                           .isValid());
+          if(++j == n) j = 0;
+        }
+        found += mine;
+        if(running.fetch_sub(1) == 1) tend = bench_clock::now();
+      }));
+    }
+    tini = bench_clock::now();
+    go.store(true, std::memory_order_release);
+    for(std::size_t r = 0; r < numReaders; ++r) readers[r].join();
+    stop = true;
+    for(std::size_t w = 0; w < numWriters; ++w) writers[w].join();
+    // Lookups per nanosecond is millions of lookups per millisecond.
+    if(repeat >= o.warmup) {
+      times.push_back(double(numReaders * values.size()) * 1000.0
+                      / elapsed_ns(tini, tend));
+    }
+    if(found != numReaders * values.size()) {
+      std::cerr << "    ERROR: not all found, "
+                << found << " found out of " << numReaders * values.size()
+                << std::endl;
+    }
+  }
+  std::ostringstream op;
+  op << "mt-search-r" << numReaders << "-w" << numWriters;
+  report.row("Concurrent Radix Tree", op.str(), values.size(), "Mops/s",
+             times);
+}
 
-/******************************************************************************/
+/******************************************************************************\
+ * Trace replay.  Streams a recorded trace through a container, one
+ * record at a time, and reports the throughput of each kind of
+ * operation in millions of operations per second.  The clock is read
+ * whenever the operation changes, and every 1024 records within a run
+ * of the same operation, so that the cost of reading it is spread
+ * over many operations for all but the most finely interleaved
+ * traces.
+ *
+ * The intrusive trees link in the MemoryMappings they are given, so
+ * those are allocated here as the trace inserts them and reused once
+ * they are erased; other containers copy from a temporary.
+\******************************************************************************/
 
 template<class Iterator>
-void test_insertion(MemoryContainer<Iterator> &c,
-                    const char *ContainerName,
-                    std::vector<MemoryMapping> &values,
-                    std::size_t numRepeat) {
-  ptime tini, tend;
-  std::vector<double> times;
-  // Insert
-  std::cout << ContainerName << ",insert";
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      c.clear();
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        c.insert(values[i]);
+void test_trace(MemoryContainer<Iterator> &c,
+                const char *ContainerName,
+                Trace &trace,
+                const BenchOptions &o,
+                Reporter &report) {
+  const unsigned nops = TraceRecord::num_ops;
+  std::vector<double> times[nops + 1];
+  std::deque<MemoryMapping> nodes;
+  std::vector<MemoryMapping*> unused;
+  const bool holds = c.holds_mappings();
+  std::size_t records = 0, misses = 0;
+  for(std::size_t repeat = 0; repeat != o.warmup + o.repeats; ++repeat) {
+    c.clear();
+    nodes.clear();
+    unused.clear();
+    std::size_t count[nops] = { 0 };
+    double ns[nops] = { 0.0 };
+    std::size_t run = 0;
+    records = misses = 0;
+    Trace::Cursor cursor = trace.records();
+    TraceRecord r;
+    unsigned op = TraceRecord::INSERT;
+    bench_clock::time_point tini = bench_clock::now(), tend;
+    bench_clock::time_point start = tini;
+    while(cursor.next(r)) {
+      if(r.op != op || run == 1024) {
+        tend = bench_clock::now();
+        ns[op] += elapsed_ns(tini, tend);
+        tini = tend;
+        op = r.op;
+        run = 0;
       }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())
-                      /double(values.size()));
-      std::cout << "," << times.back();
-      if(c.size() != values.size()){
-        std::cerr << "    ERROR: size not consistent" << std::endl;
+      ++run;
+      ++count[op];
+      switch(op) {
+      case TraceRecord::INSERT:
+        if(holds) {
+          MemoryMapping *mm;
+          if(unused.empty()) {
+            nodes.push_back(MemoryMapping(r.vaddr, r.paddr));
+            mm = &nodes.back();
+          } else {
+            mm = unused.back();
+            unused.pop_back();
+            *mm = MemoryMapping(r.vaddr, r.paddr);
+          }
+          std::size_t before = c.size();
+          c.insert(*mm);
+          // Already mapped, so the container did not take it
+          if(c.size() == before) unused.push_back(mm);
+        } else {
+          MemoryMapping mm(r.vaddr, r.paddr);
+          c.insert(mm);
+        }
+        break;
+      case TraceRecord::LOOKUP: {
+        MemoryMapping key(r.vaddr, 0);
+        misses += static_cast<std::size_t>(c.end() == c.find(key));
+        break;
       }
-    }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
-    }
-    std::cout << "," << total/numRepeat << std::endl;
-  }
-  // Search
-  std::cout << ContainerName << ",search";
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      std::size_t found = 0;
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        found += static_cast<std::size_t>(c.end() != c.find(values[i]));
+      case TraceRecord::ERASE: {
+        MemoryMapping key(r.vaddr, 0);
+        MemoryMapping *held = c.erase(key);
+        if(held != NULL && held != &key) unused.push_back(held);
+        break;
       }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())/
-                      double(values.size()));
-      std::cout << "," << times.back();
-      if(found != values.size()){
-        std::cerr << "    ERROR: not all found, "
-                  << found << " found out of " << values.size()
-                  << std::endl;
       }
     }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
+    tend = bench_clock::now();
+    ns[op] += elapsed_ns(tini, tend);
+    for(unsigned i = 0; i < nops; ++i) records += count[i];
+    if(repeat < o.warmup) continue;
+    for(unsigned i = 0; i < nops; ++i) {
+      times[i].push_back(ns[i] == 0.0 ? 0.0 : double(count[i]) * 1000.0
+                         / ns[i]);
     }
-    std::cout << "," << total/numRepeat << std::endl;
+    times[nops].push_back(double(records) * 1000.0
+                          / elapsed_ns(start, tend));
+  }
+  for(unsigned i = 0; i <= nops; ++i) {
+    report.row(ContainerName,
+               std::string("trace-") +
+               (i == nops ? "total" : TraceRecord::name(i)),
+               records, "Mops/s", times[i]);
   }
+  std::cerr << ContainerName << ": " << records << " records, "
+            << misses << " lookups missed" << std::endl;
   c.clear();
 }
 
+// Replays the trace at path through every selected container.
+int replay_trace(const char *path, const BenchOptions &o) {
+  try {
+    Trace trace(path);
+    std::cerr << "Trace:                 " << path << " ("
+              << (trace.binary() ? "binary" : "text") << ", "
+              << trace.bytes() << " bytes)" << std::endl;
+    Reporter report(o);
+    if(o.selected("rb")) {
+      RBTreeContainer rbtc;
+      test_trace(rbtc, "Red-Black Tree", trace, o, report);
+    }
+    if(o.selected("avl")) {
+      AVLTreeContainer avltc;
+      test_trace(avltc, "AVL Tree", trace, o, report);
+    }
+    if(o.selected("splay")) {
+      SplayTreeContainer splaytc;
+      test_trace(splaytc, "Splay Tree", trace, o, report);
+    }
+    if(o.selected("radix")) {
+      RadixTreeContainer radixtc;
+      test_trace(radixtc, "Radix Tree", trace, o, report);
+    }
+    if(o.selected("hashed")) {
+      HashedPageTableContainer hashptc;
+      test_trace(hashptc, "Hashed Page Table", trace, o, report);
+    }
+    if(o.selected("swiss")) {
+      SwissTableContainer swisstc;
+      test_trace(swisstc, "Swiss Table", trace, o, report);
+    }
+    if(o.selected("bplus")) {
+      BPlusTreeContainer<16> bplustc;
+      test_trace(bplustc, "B+ Tree (16)", trace, o, report);
+    }
+    if(o.selected("range")) {
+      RangeTreeContainer rangetc;
+      test_trace(rangetc, "Range Tree", trace, o, report);
+    }
+    if(o.selected("maple")) {
+      MapleTreeContainer mapletc;
+      test_trace(mapletc, "Maple Tree", trace, o, report);
+    }
+  } catch(std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Writes the inserts and then the lookups of the workload as a
+// binary trace.
+int write_trace(const char *path, std::vector<MemoryMapping> &values,
+                std::vector<MemoryMapping> &searches) {
+  try {
+    TraceWriter w(path);
+    for(std::size_t i = 0; i < values.size(); ++i)
+      w.write(TraceRecord::INSERT, values[i].getVA(), values[i].getPA());
+    for(std::size_t i = 0; i < searches.size(); ++i)
+      w.write(TraceRecord::LOOKUP, searches[i].getVA(), 0);
+    w.close();
+  } catch(std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
 /******************************************************************************/
 
 
-int main() {
+int main(int argc, char **argv) {
 
 #ifdef NDEBUG
-  std::size_t numElem = 1000000;
-  std::size_t numRepeat = 30;
+  BenchOptions o(1000000, 30);
+  std::size_t numRegions = 10000;
+  std::size_t maxRegionPages = 256;
 #else
-  std::size_t numElem = 10000;
-  std::size_t numRepeat = 4;
+  BenchOptions o(10000, 4);
+  std::size_t numRegions = 100;
+  std::size_t maxRegionPages = 64;
 #endif
-  
-  std::random_device device;
-  std::mt19937 generator(device());
+
+  Workload workload;
+  const char *tracePath = NULL, *writePath = NULL;
+  for(int i = 1; i < argc; ++i) {
+    if(strncmp(argv[i], "--trace=", 8) == 0) {
+      tracePath = argv[i] + 8;
+    } else if(strncmp(argv[i], "--write-trace=", 14) == 0) {
+      writePath = argv[i] + 14;
+    } else if(!workload.parse(argv[i]) && !o.parse(argv[i])) {
+      std::cerr << "Usage: " << argv[0] << " " << BenchOptions::usage()
+                << " " << Workload::usage()
+                << " [--trace=FILE] [--write-trace=FILE]" << std::endl
+                << "Containers: rb avl splay radix hashed swiss bplus range"
+                << " maple asid concurrent" << std::endl;
+      return 1;
+    }
+  }
+  if(tracePath != NULL) return replay_trace(tracePath, o);
+
+  const std::size_t numElem = o.elements;
+  std::mt19937 generator(workload.seed);
   std::uniform_int_distribution<uint64_t>
     dist(0, std::numeric_limits<uint64_t>::max());
   std::vector<MemoryMapping> values;
-  // Create several MemoryMapping objects, each one with a different value
-  std::srand(0);
-  for(uint64_t i = 0; i < numElem; ++i)  {
-    uint64_t vadd = correctify_vadd(dist(generator));
-    uint64_t padd = correctify_padd(vadd, dist(generator));
-    values.push_back(MemoryMapping(vadd, padd));
-  }
-  // Randomize the order
-  std::random_shuffle(values.begin(), values.end());
+  std::vector<MemoryMapping> searches;
+  // Create several MemoryMapping objects, each one with a different
+  // page, and put them in insert and lookup order
+  workload.mappings(numElem, values);
+  workload.order_inserts(values);
+  workload.lookups(values, numElem, searches);
+  if(writePath != NULL) return write_trace(writePath, values, searches);
 
   std::cerr << "Number of elements:    " << numElem << std::endl
-            << "Number of repetitions: " << numRepeat << std::endl;
-  std::cout << "Data Structure,Operation";
+            << "Number of repetitions: " << o.repeats
+            << " (+" << o.warmup << " warmup)" << std::endl
+            << "Workload:              " << workload.describe() << std::endl;
+  Reporter report(o);
 
-  for(int i = 0; i < numRepeat; ++i) {
-    std::cout << ",trial" << i;
-  }
-  std::cout << ",average" << std::endl;
-
-  {
+  if(o.selected("rb")) {
     RBTreeContainer rbtc;
-    test_insertion(rbtc, "Red-Black Tree", values, numRepeat);
+    test_insertion(rbtc, "Red-Black Tree", values, searches, o, report);
+    test_bulk_insertion(rbtc, "Red-Black Tree", values, searches, o, report);
   }
 
-  {
+  if(o.selected("avl")) {
     AVLTreeContainer avltc;
-    test_insertion(avltc, "AVL Tree", values, numRepeat);
+    test_insertion(avltc, "AVL Tree", values, searches, o, report);
+    test_bulk_insertion(avltc, "AVL Tree", values, searches, o, report);
   }
 
-  {
+  if(o.selected("splay")) {
     SplayTreeContainer splaytc;
-    test_insertion(splaytc, "Splay Tree", values, numRepeat);
+    test_insertion(splaytc, "Splay Tree", values, searches, o, report);
+    test_bulk_insertion(splaytc, "Splay Tree", values, searches, o, report);
+  }
+
+  if(o.selected("radix")) {
+    RadixTreeContainer radixtc;
+    test_insertion(radixtc, "Radix Tree", values, searches, o, report);
+    test_bulk_insertion(radixtc, "Radix Tree", values, searches, o, report);
+  }
+
+  if(o.selected("hashed")) {
+    HashedPageTableContainer hashptc;
+    test_insertion(hashptc, "Hashed Page Table", values, searches, o,
+                   report);
+    hashptc.reserve(values.size());
+    test_insertion(hashptc, "Hashed Page Table (reserved)", values,
+                   searches, o, report);
   }
 
+  if(o.selected("swiss")) {
+    SwissTableContainer swisstc;
+    test_insertion(swisstc, "Swiss Table", values, searches, o, report);
+    swisstc.reserve(values.size());
+    test_insertion(swisstc, "Swiss Table (reserved)", values, searches, o,
+                   report);
+  }
+
+  // Fan-out from a binary-like B+ tree up to one with 64 keys a node
+  if(o.selected("bplus")) {
+    BPlusTreeContainer<4> bplustc4;
+    test_insertion(bplustc4, "B+ Tree (4)", values, searches, o, report);
+    BPlusTreeContainer<16> bplustc16;
+    test_insertion(bplustc16, "B+ Tree (16)", values, searches, o, report);
+    BPlusTreeContainer<64> bplustc64;
+    test_insertion(bplustc64, "B+ Tree (64)", values, searches, o, report);
+    test_scans(values, searches, o, report);
+  }
+
+  if(o.selected("range")) {
+    RangeTreeContainer rangetc;
+    test_insertion(rangetc, "Range Tree", values, searches, o, report);
+  }
+
+  if(o.selected("maple")) {
+    MapleTreeContainer mapletc;
+    test_insertion(mapletc, "Maple Tree", values, searches, o, report);
+  }
+
+  // Lay out non-overlapping regions of random size, separated by
+  // random gaps, each backed by a contiguous physical range.
+  std::vector<Region> regions;
+  std::vector<MemoryMapping> pages;
+  std::vector<MemoryMapping> lookups;
   {
+    const uint64_t page = RangeTree::page_size;
+    std::uniform_int_distribution<uint64_t> npages(1, maxRegionPages);
+    std::uniform_int_distribution<uint64_t> ngap(1, 16);
+    uint64_t cursor = 0x10000000;
+    for(std::size_t i = 0; i < numRegions; ++i) {
+      Region r;
+      r.start = cursor + ngap(generator) * page;
+      r.numPages = npages(generator);
+      r.end = r.start + r.numPages * page;
+      r.pa = correctify_padd(0, dist(generator));
+      r.firstPage = pages.size();
+      for(std::size_t p = 0; p < r.numPages; ++p) {
+        pages.push_back(MemoryMapping(r.start + p * page, r.pa + p * page));
+      }
+      regions.push_back(r);
+      cursor = r.end;
+    }
+    std::shuffle(regions.begin(), regions.end(), generator);
+    for(std::size_t i = 0; i < numElem; ++i) {
+      Region &r = regions[dist(generator) % regions.size()];
+      uint64_t p = dist(generator) % r.numPages;
+      lookups.push_back(MemoryMapping(r.start + p * page, r.pa + p * page));
+    }
+  }
+  std::cerr << "Number of regions:     " << regions.size() << std::endl
+            << "Number of pages:       " << pages.size() << std::endl;
+
+  if(o.selected("range")) {
+    RangeTree rt;
+    test_regions(rt, "Range Tree", regions, lookups, o, report);
+  }
+
+  if(o.selected("maple")) {
+    MapleTree mt;
+    test_regions(mt, "Maple Tree", regions, lookups, o, report);
+  }
+
+  if(o.selected("rb")) {
+    RBTree rbt;
+    test_regions_paged(rbt, "Red-Black Tree", regions, pages, lookups,
+                       o, report);
+  }
+
+  if(o.selected("avl")) {
+    AVLTree avlt;
+    test_regions_paged(avlt, "AVL Tree", regions, pages, lookups, o, report);
+  }
+
+  if(o.selected("splay")) {
+    SplayTree splayt;
+    test_regions_paged(splayt, "Splay Tree", regions, pages, lookups,
+                       o, report);
+  }
+
+  // Lookups with temporal locality: a working set of 32 mappings,
+  // which moves on every 1024 lookups.
+  std::vector<MemoryMapping> local;
+  for(std::size_t i = 0; i < numElem; ++i) {
+    local.push_back(values[((i / 1024) * 32 + dist(generator) % 32)
+                           % values.size()]);
+  }
+
+  if(o.selected("rb")) {
+    RBTreeContainer rbtc;
+    test_lookups(rbtc, "Red-Black Tree", values, local, o, report);
+    TranslationCache<RBTree::iterator> tlb(rbtc, 16, 4, LRU);
+    test_cache(tlb, "Red-Black Tree+TLB(16x4 LRU)", values, local,
+               o, report);
+  }
+
+  if(o.selected("radix")) {
     RadixTreeContainer radixtc;
-    test_insertion(radixtc, "Radix Tree", values, numRepeat);
+    test_lookups(radixtc, "Radix Tree", values, local, o, report);
+    TranslationCache<RadixTreeIterator> lru(radixtc, 16, 4, LRU);
+    test_cache(lru, "Radix Tree+TLB(16x4 LRU)", values, local, o, report);
+    TranslationCache<RadixTreeIterator> fifo(radixtc, 16, 4, FIFO);
+    test_cache(fifo, "Radix Tree+TLB(16x4 FIFO)", values, local, o, report);
+    TranslationCache<RadixTreeIterator> rnd(radixtc, 16, 4, RANDOM);
+    test_cache(rnd, "Radix Tree+TLB(16x4 RANDOM)", values, local, o, report);
+    TranslationCache<RadixTreeIterator> small(radixtc, 4, 2, LRU);
+    test_cache(small, "Radix Tree+TLB(4x2 LRU)", values, local, o, report);
   }
-  
+
+  // Context switching among address spaces sharing one TLB, each
+  // mapping a slice of the values, with lookups of the same kind.
+  if(o.selected("asid")) {
+    std::vector<MemoryMapping> slice(values.begin(), values.begin() +
+                                     std::max<std::size_t>(numElem / 64, 1));
+    std::vector<MemoryMapping> sliceLocal;
+    for(std::size_t i = 0; i < numElem; ++i) {
+      sliceLocal.push_back(slice[((i / 1024) * 32 + dist(generator) % 32)
+                                 % slice.size()]);
+    }
+    const std::size_t spaceCounts[] = { 1, 4, 16, 64 };
+    const std::size_t quanta[] = { 64, 1024, 16384 };
+    for(std::size_t spaces : spaceCounts) {
+      for(std::size_t quantum : quanta) {
+        test_address_spaces(slice, sliceLocal, spaces, quantum, o, report);
+      }
+    }
+  }
+
+  // Reader and writer scaling for the concurrent radix tree.
+  if(o.selected("concurrent")) {
+    std::vector<MemoryMapping> churn;
+    for(std::size_t i = 0; i <= numElem / 10; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator));
+      churn.push_back(MemoryMapping(vadd, correctify_padd(vadd,
+                                                         dist(generator))));
+    }
+    const std::size_t readerCounts[] = { 1, 2, 4, 8 };
+    for(std::size_t w = 0; w <= 2; ++w) {
+      for(std::size_t r = 0; r < 4; ++r) {
+        test_concurrent(values, churn, readerCounts[r], w, o, report);
+      }
+    }
+  }
+
   return 0;
 }
@@ -0,0 +1,172 @@
+#ifndef MAPLETREE_HPP
+#define MAPLETREE_HPP
+/******************************************************************************\
+ * Maple Tree
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <vector>
+#include <cstdint>
+#include "bplustree.hpp"
+
+/******************************************************************************\
+ * Maple Tree.  A mock-up of the Linux maple tree, which replaced the
+ * red-black tree of VMAs: a B-tree of non-overlapping ranges whose
+ * nodes keep their range boundaries (pivots) apart from what the
+ * ranges map to (slots), so that a lookup reads a cache line or two
+ * of pivots per level rather than one node per level as in RangeTree.
+ *
+ * Each range [start, end) is kept in a BPlusTree keyed on its start,
+ * with its end, physical address and permissions as the value.  The
+ * range containing an address is the last one starting at or below
+ * it, if that one ends above it, so a lookup is a single descent.
+ *
+ * The interface and semantics are those of RangeTree: map() replaces
+ * whatever was in its range, unmap() and protect() split ranges
+ * straddling either end of theirs, and neighbours which are virtually
+ * and physically contiguous with equal permissions are merged.  The
+ * kernel's tree also lets lookups run under RCU alongside a writer;
+ * this one, like the rest of the project, is single-threaded.
+\******************************************************************************/
+
+class MapleTree {
+public:
+  struct Range {
+    uint64_t end;
+    uint64_t pa;
+    uint8_t prot;
+  };
+
+private:
+  typedef BPlusTree<16, Range> tree_t;
+
+  struct Cut {
+    uint64_t start;
+    Range r;
+  };
+
+  tree_t t_;
+  std::vector<Cut> cut_;   // The ranges removed by the last cut()
+
+  static bool mergeable(uint64_t as, const Range &a,
+                        uint64_t bs, const Range &b) {
+    return a.end == bs && a.prot == b.prot && a.pa + (a.end - as) == b.pa;
+  }
+
+  // Removes every range overlapping [start, end) into cut_.
+  void cut(uint64_t start, uint64_t end) {
+    cut_.clear();
+    tree_t::iterator it = t_.floor(start);
+    if(it == t_.end() || (*it).end <= start) it = t_.lower_bound(start);
+    for(; it != t_.end() && it.key() < end; ++it) {
+      Cut c = { it.key(), *it };
+      cut_.push_back(c);
+    }
+    for(std::size_t i = 0; i < cut_.size(); ++i) t_.erase(cut_[i].start);
+  }
+
+  // Puts back the parts of the cut ranges lying outside [start, end).
+  void restore_outside(uint64_t start, uint64_t end) {
+    for(std::size_t i = 0; i < cut_.size(); ++i) {
+      const Cut &c = cut_[i];
+      if(c.start < start) {
+        Range left = { start, c.r.pa, c.r.prot };
+        t_.insert(c.start, left);
+      }
+      if(c.r.end > end) {
+        Range right = { c.r.end, c.r.pa + (end - c.start), c.r.prot };
+        t_.insert(end, right);
+      }
+    }
+  }
+
+  // Merges the range beginning at start with its neighbours where
+  // possible.
+  void merge_around(uint64_t start) {
+    Range r = *t_.find(start);
+    if(start > 0) {
+      tree_t::iterator prev = t_.floor(start - 1);
+      if(prev != t_.end() && mergeable(prev.key(), *prev, start, r)) {
+        uint64_t prevStart = prev.key();
+        r.pa = (*prev).pa;
+        t_.erase(start);
+        start = prevStart;
+        t_.insert(start, r);
+      }
+    }
+    tree_t::iterator next = t_.find(r.end);
+    if(next != t_.end() && mergeable(start, r, next.key(), *next)) {
+      uint64_t nextStart = next.key();
+      r.end = (*next).end;
+      t_.erase(nextStart);
+      t_.insert(start, r);
+    }
+  }
+
+public:
+  typedef tree_t::iterator iterator;
+
+  static const std::uint64_t page_size = 4096;
+
+  MapleTree() : t_() {}
+
+  // mmap(MAP_FIXED): map [start, end) to the physical range beginning
+  // at pa, replacing anything previously mapped there.
+  void map(uint64_t start, uint64_t end, uint64_t pa, uint8_t prot) {
+    cut(start, end);
+    restore_outside(start, end);
+    Range r = { end, pa, prot };
+    t_.insert(start, r);
+    merge_around(start);
+  }
+
+  // munmap: remove every mapping in [start, end).
+  void unmap(uint64_t start, uint64_t end) {
+    cut(start, end);
+    restore_outside(start, end);
+  }
+
+  // mprotect: change the permissions of every mapping in [start, end).
+  void protect(uint64_t start, uint64_t end, uint8_t prot) {
+    cut(start, end);
+    restore_outside(start, end);
+    for(std::size_t i = 0; i < cut_.size(); ++i) {
+      const Cut &c = cut_[i];
+      uint64_t s = c.start < start ? start : c.start;
+      Range r = { c.r.end > end ? end : c.r.end, c.r.pa + (s - c.start),
+                  prot };
+      t_.insert(s, r);
+    }
+    // Merge each piece, or the range which has already swallowed it,
+    // with its neighbours; the last may merge with the range after it.
+    for(std::size_t i = 0; i < cut_.size(); ++i) {
+      uint64_t s = cut_[i].start < start ? start : cut_[i].start;
+      merge_around(find(s).key());
+    }
+  }
+
+  // Returns the range covering vadd, or end() if it is unmapped.  The
+  // range begins at key() and its value() gives the rest.
+  iterator find(uint64_t vadd) {
+    iterator it = t_.floor(vadd);
+    if(it == t_.end() || (*it).end <= vadd) return t_.end();
+    return it;
+  }
+
+  // Physical address of vadd, which must lie in the range at it.
+  static uint64_t translate(const iterator &it, uint64_t vadd) {
+    return (*it).pa + (vadd - it.key());
+  }
+
+  iterator begin() { return t_.begin(); }
+  iterator end() { return t_.end(); }
+  void clear() { t_.clear(); }
+  size_t size() { return t_.size(); }
+  // Bytes of memory held by the tree's nodes.
+  size_t memory_bytes() { return sizeof(*this) + t_.memory_bytes(); }
+  unsigned height() { return t_.height(); }
+};
+
+/******************************************************************************/
+#endif
@@ -8,87 +8,11 @@
 
 #include <iostream>
 #include <array>
-#include <cmath>
 #include <cassert>
 
-#define TABLE_BITS 12
-
-size_t key(uint64_t k, size_t level, size_t N) {
-  const uint64_t LEVEL_BITS = 36 / N;
-  const uint64_t LEVEL_MASK = pow(2, LEVEL_BITS) - 1;
-  const uint64_t shift = ((level-1)*LEVEL_BITS + TABLE_BITS);
-  return (k & (LEVEL_MASK << shift)) >> shift;
-}
-
-template <std::size_t N, std::size_t M>
-struct basic_marray {
-  typedef std::array<typename basic_marray<N-1, M>::T*, M> T;
-
-  static uint64_t get(T& m, uint64_t k, size_t topN) {
-    size_t level_key = key(k, N, topN);
-    // std::cout << std::dec;
-    // std::cout << "Getting <" << N << "," << M << ">[" << level_key << "]" << std::endl;
-    return basic_marray<N-1, M>::get(*(m[level_key]), k, topN);
-  }
-
-  static void set(T& m, uint64_t k, size_t topN, uint64_t v) {
-    size_t level_key = key(k, N, topN);
-    assert(level_key < M);
-    if(m[level_key] == NULL) {
-      m[level_key] = new typename basic_marray<N-1, M>::T();
-      basic_marray<N-1, M>::init(*(m[level_key]));
-      // std::cout << "Alloc: Marray<" << std::dec << N << "," << M << ">[" << level_key << "] = "
-      //           << std::hex << m[level_key] << std::endl;
-    }
-    basic_marray<N-1, M>::set(*(m[level_key]), k, topN, v);
-  }
-
-  static void clear(T& m) {
-    for(size_t i = 0; i < M; ++i) {
-      if(m[i] == NULL) continue;
-      basic_marray<N-1, M>::clear(*(m[i]));
-      // std::cout << "Free Marray<" << std::dec << N << "," << M << ">[" << i << "] = "
-      //           << std::hex << m[i] << std::endl;
-      delete m[i];
-      m[i] = NULL;
-    }
-  }
-
-  static void init(T& m) {
-    for(size_t i = 0; i < M; ++i) {
-      m[i] = (typename basic_marray<N-1, M>::T*)NULL;
-    }
-  }
-};
+#include "pagetable.hpp"
 
-template <std::size_t M>
-struct basic_marray<1, M> {
-  typedef std::array<uint64_t, M> T;
-
-  static uint64_t get(T m, uint64_t k, size_t topN) {
-    size_t level_key = key(k, 1, topN);
-    // std::cout << std::dec;
-    // std::cout << "Getting Marray<1," << M << ">[" << level_key << "] = 0x" << std::hex << m[level_key] << std::endl;
-    return m[level_key];
-  }
-
-  static void set(T& m, uint64_t k, size_t topN, uint64_t v) {
-    size_t level_key = key(k, 1, topN);
-    // std::cout << std::dec;
-    // std::cout << "Setting Marray<1," << M << ">[" << level_key << "] = 0x" << std::hex << v << std::endl;
-    m[level_key] = v;
-  }
-
-  static void clear(T& m) {
-    // Do nothing at this level
-  }
-
-  static void init(T& m) {
-    for(size_t i = 0; i < M; ++i) {
-      m[i] = (uint64_t)NULL;
-    }
-  }
-};
+#define TABLE_BITS 12
 
 /******************************************************************************/
 #ifndef NDEBUG
@@ -106,12 +30,10 @@ struct pow_t<X, 0> {
 #endif
 /******************************************************************************/
 
+// An N-level page table of 36 bits above a TABLE_BITS offset, with a
+// uniform fan-out of M at every level.
 template <std::size_t N, std::size_t M>
 class Marray {
-private:
-  using marray = typename basic_marray<N,M>::T;
-  using barray = typename basic_marray<1,M>::T;
-  
 public:
 
   static const uint8_t KEY_BITS = 36;
@@ -125,21 +47,23 @@ public:
                  "Marray: Table size (M) should be 2**(36/N)");
 #endif
 private:
-  marray m;
+  typename uniform_pagetable<TABLE_BITS, N, KEY_BITS / N>::type m;
 
 public:
-  Marray() { basic_marray<N,M>::init(m); }
+  Marray() : m() {}
   ~Marray() { clear(); }
   
   uint64_t get(uint64_t k) {
-	return basic_marray<N,M>::get(m, k, N);
+	return m.get(k);
   }
 
   void set(uint64_t k, uint64_t v) {
-    basic_marray<N,M>::set(m, k, N, v);
+    m.set(k, v);
   }
 
-  void clear() { basic_marray<N,M>::clear(m); }
+  void clear() { m.clear(); }
+
+  std::size_t tables() { return m.tables(); }
 };
 
 /******************************************************************************/
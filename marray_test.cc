@@ -1,4 +1,3 @@
-#include <boost/date_time/posix_time/posix_time.hpp>
 #include <set>
 #include <iostream>
 #include <vector>
@@ -6,141 +5,92 @@
 #include <cassert>
 #include <random>
 #include <cstdint>
+#include <sstream>
 #include "radixtree.hpp"
 #include "marray.hpp"
+#include "workload.hpp"
+#include "bench.hpp"
 
 using MemoryMapping = std::pair<uint64_t, uint64_t>;
-using namespace boost::posix_time;
 
 template<std::size_t N, std::size_t M>
-void test_insertion(Marray<N,M> m,
+void test_insertion(Marray<N,M> &m,
                     std::vector<MemoryMapping> &values,
-                    std::size_t numRepeat) {
-  ptime tini, tend;
-  std::vector<double> times;
-  // Insert
-  std::cout << N;
-  std::cout << std::fixed << std::setprecision(1);
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      m.clear();
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        m.set(values[i].first, values[i].second);
-      }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())
-                      /double(values.size()));
-      // if(c.size() != values.size()){
-      //   std::cerr << "    ERROR: size not consistent" << std::endl;
-      // }
-    }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
-    }
-    std::cout << "," << total/numRepeat;
-  }
-  // Search
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      std::size_t found = 0;
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        found += static_cast<std::size_t>(values[i].second ==
-                                          m.get(values[i].first));
-      }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())/
-                      double(values.size()));
-      if(found != values.size()){
-        std::cerr << "    ERROR: not all found, "
-                  << found << " found out of " << values.size()
-                  << std::endl;
-      }
-    }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
-    }
-    std::cout << "," << total/numRepeat << std::endl;
-  }
+                    std::vector<MemoryMapping> &lookups,
+                    const BenchOptions &o,
+                    Reporter &report) {
+  std::ostringstream name;
+  name << "Marray<" << N << ";" << M << ">";
+  bench_insert_search(report, o, name.str(), values.size(), lookups.size(),
+                      [&]() { m.clear(); },
+                      [&](std::size_t i) {
+                        m.set(values[i].first, values[i].second);
+                      },
+                      [&](std::size_t i) {
+                        return lookups[i].second == m.get(lookups[i].first);
+                      });
   m.clear();
 }
 
-int main() {
+int main(int argc, char **argv) {
 
 #ifdef NDEBUG
-  std::size_t numElem = 1000000;
-  std::size_t numRepeat = 30;
+  BenchOptions o(1000000, 30);
 #else
-  std::size_t numElem = 100;
-  std::size_t numRepeat = 4;
+  BenchOptions o(100, 4);
 #endif
 
-  std::random_device device;
-  std::mt19937 generator(device());
-  std::uniform_int_distribution<uint64_t>
-    dist(0, std::numeric_limits<uint64_t>::max());
-  std::set<uint64_t> keys;
-  std::vector<MemoryMapping> values;
-  // Create several MemoryMapping objects, each one with a different value
-  std::srand(0);
-  while(keys.size() < numElem) {
-    keys.insert(correctify_vadd(dist(generator)));
-  }
-  for(set<uint64_t>::const_iterator it = keys.cbegin();
-      it != keys.cend();
-      ++it) {
-    uint64_t vadd = *it;
-    uint64_t padd = correctify_padd(vadd, dist(generator));
-    values.push_back(MemoryMapping(vadd, padd));
+  Workload workload;
+  for(int i = 1; i < argc; ++i) {
+    if(!workload.parse(argv[i]) && !o.parse(argv[i])) {
+      std::cerr << "Usage: " << argv[0] << " " << BenchOptions::usage()
+                << " " << Workload::usage() << std::endl;
+      return 1;
+    }
   }
-  // Randomize the order
-  std::random_shuffle(values.begin(), values.end());
+  std::cerr << "Workload: " << workload.describe() << std::endl;
+
+  const std::size_t numElem = o.elements;
+  std::vector<MemoryMapping> values;
+  std::vector<MemoryMapping> lookups;
+  // Create several MemoryMapping objects, each one with a different
+  // page, and put them in insert and lookup order
+  workload.mappings(numElem, values);
+  workload.order_inserts(values);
+  workload.lookups(values, numElem, lookups);
   
-  std::cout << "nlvls,avgins,avgfnd" << std::endl;
+  Reporter report(o);
   {
     Marray<2, 262144> m2;
-    test_insertion(m2, values, numRepeat);
+    test_insertion(m2, values, lookups, o, report);
   }
   {
     Marray<3, 4096> m3;
-    test_insertion(m3, values, numRepeat);
+    test_insertion(m3, values, lookups, o, report);
   }
   {
     Marray<4, 512> m4;
-    test_insertion(m4, values, numRepeat);
+    test_insertion(m4, values, lookups, o, report);
   }
   {
     Marray<6, 64> m6;
-    test_insertion(m6, values, numRepeat);
+    test_insertion(m6, values, lookups, o, report);
   }
   {
     Marray<9, 16> m6;
-    test_insertion(m6, values, numRepeat);
+    test_insertion(m6, values, lookups, o, report);
   }
   {
     Marray<12, 8> m6;
-    test_insertion(m6, values, numRepeat);
+    test_insertion(m6, values, lookups, o, report);
   }
   {
     Marray<18, 4> m6;
-    test_insertion(m6, values, numRepeat);
+    test_insertion(m6, values, lookups, o, report);
   }
   {
     Marray<36, 2> m6;
-    test_insertion(m6, values, numRepeat);
+    test_insertion(m6, values, lookups, o, report);
   }
   
   // std::cout << "Now testing marray" << std::endl;
@@ -0,0 +1,209 @@
+#ifndef NESTED_HPP
+#define NESTED_HPP
+/******************************************************************************\
+ * Nested Page Walks
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Nested Walk.  A mock-up of two-dimensional address translation
+ * under hardware virtualization, composing a guest RadixTree, which
+ * maps guest virtual to guest physical addresses, with a host
+ * RadixTree, which maps guest physical to host physical addresses.
+ *
+ * The guest's tables live in guest physical memory, so every pointer
+ * the guest walk follows, from its p4 table down, is itself a guest
+ * physical address which must be walked through the host tree before
+ * the guest table can be read, and so must the guest physical address
+ * the walk ends with.  A 4 KB translation thus costs five host walks
+ * of four references each, plus four guest references: 24 in all.
+ *
+ * The address of a guest table in this process stands in for its
+ * guest physical address, and map_guest_tables() identity-maps those
+ * pages in the host, so the walk can read the guest tables directly
+ * while counting the host references it would have needed.  Guest
+ * physical addresses of data pages should lie away from the heap.
+ *
+ * Two caches may be enabled, to measure what each saves:
+ *
+ *   a nested TLB, caching guest physical to host physical page
+ *   translations, which spares host walks for guest tables and data
+ *   pages seen recently; and
+ *
+ *   a page-walk cache of the guest's p4, p3 and p2 entries, keyed on
+ *   the guest virtual address bits above each level, which holds the
+ *   host physical address of the next guest table, so that a hit
+ *   skips both the guest references above it and their host walks.
+ *
+ * Both are direct-mapped and are not kept coherent with the trees;
+ * call flush() after changing either tree.
+\******************************************************************************/
+
+class NestedWalk {
+  typedef RadixTree::Table Table;
+
+  // A direct-mapped cache of 64-bit values, empty when it has no
+  // entries.
+  class Cache {
+    std::vector<uint64_t> tags_, vals_;
+
+  public:
+    explicit Cache(size_t entries) : tags_(entries, 0), vals_(entries, 0) {}
+    bool enabled() const { return !tags_.empty(); }
+    bool lookup(uint64_t key, uint64_t &val) const {
+      size_t i = key & (tags_.size() - 1);
+      if(tags_[i] != (key << 1 | 1)) return false;
+      val = vals_[i];
+      return true;
+    }
+    void fill(uint64_t key, uint64_t val) {
+      size_t i = key & (tags_.size() - 1);
+      tags_[i] = key << 1 | 1;
+      vals_[i] = val;
+    }
+    void flush() { std::fill(tags_.begin(), tags_.end(), 0); }
+  };
+
+  RadixTree &guest_;
+  RadixTree &host_;
+  Cache ntlb_;
+  Cache pwc_[3];   // Guest p4, p3 and p2 entries
+
+public:
+  struct Counters {
+    uint64_t translations;
+    uint64_t faults;        // Unmapped in either tree
+    uint64_t guest_refs;    // Guest table entries read
+    uint64_t host_refs;     // Host table entries read
+    uint64_t ntlb_hits, ntlb_misses;
+    uint64_t pwc_hits[3];   // Walks starting below the p4, p3, p2 entry
+  };
+
+private:
+  Counters c_;
+
+  // Walks the host tree for gpa, counting its references, and returns
+  // the host physical address or -1.
+  uint64_t host_walk(uint64_t gpa) {
+    uint64_t e = host_.t_->e[RadixTree::key<4>(gpa)];
+    ++c_.host_refs;
+    for(unsigned level = 3; level > 0; --level) {
+      if(!(e & RadixTree::PRESENT)) return -1;
+      unsigned shift = RadixTree::page_shift(level);
+      e = RadixTree::entry_table(e)->e[(gpa >> shift) &
+                                       (RadixTree::table_size - 1)];
+      ++c_.host_refs;
+      if(RadixTree::is_leaf(e, level) && (e & RadixTree::PRESENT))
+        return (e & RadixTree::ADDR_MASK) | (gpa & RadixTree::page_mask(level));
+    }
+    return -1;
+  }
+
+  // Host physical address of gpa, through the nested TLB if enabled.
+  uint64_t host_translate(uint64_t gpa) {
+    const unsigned shift = RadixTree::page_shift(1);
+    const uint64_t offset = gpa & RadixTree::page_mask(1);
+    uint64_t hpa;
+    if(ntlb_.enabled()) {
+      if(ntlb_.lookup(gpa >> shift, hpa)) {
+        ++c_.ntlb_hits;
+        return hpa | offset;
+      }
+      ++c_.ntlb_misses;
+    }
+    hpa = host_walk(gpa);
+    if(hpa != uint64_t(-1) && ntlb_.enabled())
+      ntlb_.fill(gpa >> shift, hpa & ~RadixTree::page_mask(1));
+    return hpa;
+  }
+
+  // Identity-maps the guest table t at the given level and those below.
+  void map_tables(Table *t, unsigned level) {
+    uint64_t a = reinterpret_cast<uint64_t>(t);
+    host_.insert(a, a);
+    for(size_t i = RadixTree::next_entry(t, 0);
+        level > 1 && i < RadixTree::table_size;
+        i = RadixTree::next_entry(t, i + 1)) {
+      uint64_t e = t->e[i];
+      if(!RadixTree::is_leaf(e, level))
+        map_tables(RadixTree::entry_table(e), level - 1);
+    }
+  }
+
+public:
+  // A walker over guest and host with a nested TLB of ntlbEntries and
+  // a page-walk cache of pwcEntries per level, either of which may be
+  // 0 to disable it.  Sizes must be powers of two.
+  NestedWalk(RadixTree &guest, RadixTree &host,
+             size_t ntlbEntries = 0, size_t pwcEntries = 0)
+    : guest_(guest), host_(host), ntlb_(ntlbEntries),
+      pwc_{Cache(pwcEntries), Cache(pwcEntries), Cache(pwcEntries)} {
+    reset_counters();
+  }
+
+  // Maps every guest table into the host at its own address.
+  void map_guest_tables() { map_tables(guest_.t_, 4); }
+
+  // Translates a guest virtual address to a host physical address,
+  // returning -1 if either tree leaves it unmapped.
+  uint64_t translate(uint64_t gva) {
+    ++c_.translations;
+    // Start from the deepest guest entry in the page-walk cache, or
+    // else from the guest's p4 table.
+    unsigned level = 4;
+    uint64_t table = 0;   // Host physical address of the table to read
+    if(pwc_[0].enabled()) {
+      for(unsigned l = 2; l <= 4; ++l) {
+        if(pwc_[4 - l].lookup(gva >> RadixTree::page_shift(l), table)) {
+          ++c_.pwc_hits[4 - l];
+          level = l - 1;
+          break;
+        }
+      }
+    }
+    if(level == 4) {
+      table = host_translate(reinterpret_cast<uint64_t>(guest_.t_));
+    }
+    uint64_t gpa = -1;
+    for(;; --level) {
+      if(table == uint64_t(-1)) break;
+      unsigned shift = RadixTree::page_shift(level);
+      uint64_t e = reinterpret_cast<const Table*>(table)->e[
+        (gva >> shift) & (RadixTree::table_size - 1)];
+      ++c_.guest_refs;
+      if(!(e & RadixTree::PRESENT)) break;
+      if(RadixTree::is_leaf(e, level)) {
+        gpa = (e & RadixTree::ADDR_MASK) | (gva & RadixTree::page_mask(level));
+        break;
+      }
+      table = host_translate(e & RadixTree::ADDR_MASK);
+      if(level >= 2 && pwc_[0].enabled() && table != uint64_t(-1))
+        pwc_[4 - level].fill(gva >> shift, table);
+    }
+    uint64_t hpa = gpa == uint64_t(-1) ? gpa : host_translate(gpa);
+    if(hpa == uint64_t(-1)) ++c_.faults;
+    return hpa;
+  }
+
+  void flush() {
+    ntlb_.flush();
+    for(unsigned l = 0; l < 3; ++l) pwc_[l].flush();
+  }
+
+  const Counters &counters() const { return c_; }
+  void reset_counters() { c_ = Counters(); }
+  // Guest and host references per translation.
+  double references() const {
+    return c_.translations == 0 ? 0.0 :
+      double(c_.guest_refs + c_.host_refs) / double(c_.translations);
+  }
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,189 @@
+#ifndef PAGETABLE_HPP
+#define PAGETABLE_HPP
+/******************************************************************************\
+ * Page Table
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+/******************************************************************************\
+ * Page Table Layout.  Describes how a virtual address is split into
+ * table indices: OffsetBits of page offset at the bottom, and above
+ * it one field per level, listed from the root down.  For example,
+ * x86-64 with 4-level paging is
+ *
+ *   PageTableLayout<12, 9, 9, 9, 9>      (48-bit virtual addresses)
+ *
+ * and with LA57 5-level paging
+ *
+ *   PageTableLayout<12, 9, 9, 9, 9, 9>   (57-bit virtual addresses)
+ *
+ * Levels are numbered as in RadixTree, from 1 at the leaf (p1) up to
+ * levels at the root.  Everything is constexpr, so index<L>(vadd)
+ * compiles down to a shift and a mask.
+\******************************************************************************/
+
+template <unsigned OffsetBits, unsigned... LevelBits>
+struct PageTableLayout {
+  static constexpr unsigned levels = sizeof...(LevelBits);
+  static_assert(levels > 0, "PageTableLayout: need at least one level");
+
+  // Index widths from the root down.
+  static constexpr unsigned level_bits[] = { LevelBits... };
+
+  // Width of the index field of the given level.
+  static constexpr unsigned bits(unsigned level) {
+    return level_bits[levels - level];
+  }
+
+  // Position of the lowest bit of the index field of the given level,
+  // which is also the number of address bits a leaf at that level
+  // passes straight through.
+  static constexpr unsigned shift(unsigned level) {
+    unsigned s = OffsetBits;
+    for(unsigned l = 1; l < level; ++l) s += bits(l);
+    return s;
+  }
+
+  static constexpr unsigned va_bits = shift(levels + 1);
+  static_assert(va_bits <= 64, "PageTableLayout: more than 64 address bits");
+
+  static constexpr uint64_t fanout(unsigned level) {
+    return uint64_t(1) << bits(level);
+  }
+
+  template <unsigned Level>
+  static constexpr uint64_t index(uint64_t vadd) {
+    return (vadd >> std::integral_constant<unsigned, shift(Level)>::value) &
+      std::integral_constant<uint64_t, fanout(Level) - 1>::value;
+  }
+
+  static constexpr uint64_t offset(uint64_t vadd) {
+    return vadd & ((uint64_t(1) << OffsetBits) - 1);
+  }
+};
+
+template <unsigned OffsetBits, unsigned... LevelBits>
+constexpr unsigned
+PageTableLayout<OffsetBits, LevelBits...>::level_bits[];
+
+/******************************************************************************\
+ * One level of a page table whose index field starts at bit Shift
+ * and is Bits wide, followed by the levels below it.  Each table is
+ * an array of pointers to the tables of the next level down, and the
+ * last level is an array of values.  Absent tables read as 0.
+\******************************************************************************/
+
+template <unsigned Shift, unsigned... Bits>
+struct basic_pagetable;
+
+template <unsigned Shift, unsigned B>
+struct basic_pagetable<Shift, B> {
+  static constexpr std::size_t fanout = std::size_t(1) << B;
+  typedef std::array<uint64_t, fanout> T;
+
+  static std::size_t key(uint64_t k) { return (k >> Shift) & (fanout - 1); }
+
+  static uint64_t get(const T &m, uint64_t k) { return m[key(k)]; }
+
+  static void set(T &m, uint64_t k, uint64_t v) { m[key(k)] = v; }
+
+  static void clear(T &) {
+    // Do nothing at this level
+  }
+
+  static std::size_t tables(const T &) { return 1; }
+};
+
+template <unsigned Shift, unsigned B, unsigned C, unsigned... Rest>
+struct basic_pagetable<Shift, B, C, Rest...> {
+  typedef basic_pagetable<Shift - C, C, Rest...> child;
+  static constexpr std::size_t fanout = std::size_t(1) << B;
+  typedef std::array<typename child::T*, fanout> T;
+
+  static std::size_t key(uint64_t k) { return (k >> Shift) & (fanout - 1); }
+
+  static uint64_t get(const T &m, uint64_t k) {
+    const typename child::T *c = m[key(k)];
+    return c == NULL ? 0 : child::get(*c, k);
+  }
+
+  static void set(T &m, uint64_t k, uint64_t v) {
+    typename child::T *&c = m[key(k)];
+    if(c == NULL) c = new typename child::T();
+    child::set(*c, k, v);
+  }
+
+  static void clear(T &m) {
+    for(std::size_t i = 0; i < fanout; ++i) {
+      if(m[i] == NULL) continue;
+      child::clear(*m[i]);
+      delete m[i];
+      m[i] = NULL;
+    }
+  }
+
+  static std::size_t tables(const T &m) {
+    std::size_t n = 1;
+    for(std::size_t i = 0; i < fanout; ++i)
+      if(m[i] != NULL) n += child::tables(*m[i]);
+    return n;
+  }
+};
+
+/******************************************************************************\
+ * Page Table.  A map from virtual addresses to 64-bit values with the
+ * given layout.  Keys are only compared on the bits covered by the
+ * layout; values are stored as given, and 0 means absent.
+\******************************************************************************/
+
+template <unsigned OffsetBits, unsigned... LevelBits>
+class PageTable {
+public:
+  typedef PageTableLayout<OffsetBits, LevelBits...> layout;
+
+private:
+  typedef basic_pagetable<layout::shift(layout::levels), LevelBits...> root;
+  std::unique_ptr<typename root::T> m_;
+
+public:
+  PageTable() : m_(new typename root::T()) {}
+  PageTable(const PageTable&) = delete;
+  PageTable& operator=(const PageTable&) = delete;
+  ~PageTable() { clear(); }
+
+  uint64_t get(uint64_t k) { return root::get(*m_, k); }
+
+  void set(uint64_t k, uint64_t v) { root::set(*m_, k, v); }
+
+  void clear() { root::clear(*m_); }
+
+  // Number of tables allocated, including the root.
+  std::size_t tables() { return root::tables(*m_); }
+};
+
+/******************************************************************************\
+ * A page table of N levels of Bits bits each above OffsetBits, for
+ * layouts with a uniform fan-out:
+ *
+ *   uniform_pagetable<12, 4, 9>::type  is  PageTable<12, 9, 9, 9, 9>
+\******************************************************************************/
+
+template <unsigned OffsetBits, std::size_t N, unsigned Bits,
+          unsigned... Acc>
+struct uniform_pagetable
+  : uniform_pagetable<OffsetBits, N - 1, Bits, Bits, Acc...> {};
+
+template <unsigned OffsetBits, unsigned Bits, unsigned... Acc>
+struct uniform_pagetable<OffsetBits, 0, Bits, Acc...> {
+  typedef PageTable<OffsetBits, Acc...> type;
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,125 @@
+#include <set>
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <cassert>
+#include <random>
+#include <cstdint>
+#include "radixtree.hpp"
+#include "marray.hpp"
+#include "pagetable.hpp"
+#include "bench.hpp"
+
+using MemoryMapping = std::pair<uint64_t, uint64_t>;
+
+// Gives the hand-written RadixTree the same interface as PageTable.
+class RadixTreeTable {
+  RadixTree rt_;
+
+public:
+  uint64_t get(uint64_t k) {
+    RadixTreeIterator it = rt_.find(k);
+    return it.isValid() ? *it : 0;
+  }
+  void set(uint64_t k, uint64_t v) { rt_.insert(k, v); }
+  void clear() { rt_.clear(); }
+  std::size_t tables() { return rt_.tables(); }
+};
+
+template<class Table>
+void test_insertion(Table &m,
+                    const char *LayoutName,
+                    std::size_t levels,
+                    std::size_t vaBits,
+                    std::vector<MemoryMapping> &values,
+                    const BenchOptions &o,
+                    Reporter &report) {
+  const std::size_t n = values.size();
+  bench_insert_search(report, o, LayoutName, n, n,
+                      [&]() { m.clear(); },
+                      [&](std::size_t i) {
+                        m.set(values[i].first, values[i].second);
+                      },
+                      [&](std::size_t i) {
+                        return values[i].second == m.get(values[i].first);
+                      });
+  report.value(LayoutName, "levels", n, "count", levels);
+  report.value(LayoutName, "va-bits", n, "bits", vaBits);
+  report.value(LayoutName, "tables", n, "count", m.tables());
+  m.clear();
+}
+
+template<class Table>
+void test_layout(const char *LayoutName,
+                 std::vector<MemoryMapping> &values,
+                 const BenchOptions &o,
+                 Reporter &report) {
+  Table m;
+  test_insertion(m, LayoutName, Table::layout::levels,
+                 Table::layout::va_bits, values, o, report);
+}
+
+int main(int argc, char **argv) {
+
+#ifdef NDEBUG
+  BenchOptions o(100000, 30);
+#else
+  BenchOptions o(1000, 4);
+#endif
+  for(int i = 1; i < argc; ++i) {
+    if(!o.parse(argv[i])) {
+      std::cerr << "Usage: " << argv[0] << " " << BenchOptions::usage()
+                << std::endl;
+      return 1;
+    }
+  }
+  const std::size_t numElem = o.elements;
+
+  std::random_device device;
+  std::mt19937 generator(device());
+  std::uniform_int_distribution<uint64_t>
+    dist(0, std::numeric_limits<uint64_t>::max());
+  std::set<uint64_t> pages;
+  std::vector<MemoryMapping> values;
+  // Create several MemoryMapping objects, each one in a different
+  // page of the 48-bit address space, so that every layout below
+  // holds all of them.
+  while(pages.size() < numElem) {
+    pages.insert(correctify_vadd(dist(generator)) & 0xfffffffff000);
+  }
+  for(std::set<uint64_t>::const_iterator it = pages.cbegin();
+      it != pages.cend();
+      ++it) {
+    uint64_t vadd = *it | (dist(generator) & 0xfff);
+    uint64_t padd = correctify_padd(vadd, dist(generator));
+    values.push_back(MemoryMapping(vadd, padd));
+  }
+  // Randomize the order
+  std::random_shuffle(values.begin(), values.end());
+
+  Reporter report(o);
+  {
+    RadixTreeTable rt;
+    test_insertion(rt, "RadixTree", 4, 48, values, o, report);
+  }
+  {
+    Marray<4, 512> m4;
+    test_insertion(m4, "Marray<4;512>", 4, 48, values, o, report);
+  }
+  test_layout< PageTable<12, 9, 9, 9, 9> >
+    ("PageTable<12;9;9;9;9>", values, o, report);
+  test_layout< PageTable<12, 9, 9, 9, 9, 9> >
+    ("PageTable<12;9;9;9;9;9>", values, o, report);
+  test_layout< PageTable<12, 12, 8, 8, 8> >
+    ("PageTable<12;12;8;8;8>", values, o, report);
+  test_layout< PageTable<12, 10, 10, 8, 8> >
+    ("PageTable<12;10;10;8;8>", values, o, report);
+  test_layout< PageTable<12, 8, 8, 10, 10> >
+    ("PageTable<12;8;8;10;10>", values, o, report);
+  test_layout< uniform_pagetable<12, 6, 6>::type >
+    ("PageTable<12;6*6>", values, o, report);
+  test_layout< uniform_pagetable<12, 9, 4>::type >
+    ("PageTable<12;4*9>", values, o, report);
+
+  return 0;
+}
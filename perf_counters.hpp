@@ -0,0 +1,192 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+/******************************************************************************\
+ * Hardware Performance Counters
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/******************************************************************************\
+ * Perf Counters.  Counts hardware events in the calling thread, in
+ * user space only, with perf_event_open(2).  The events are chosen
+ * at runtime by name:
+ *
+ *   cycles  instructions  branches  branch-misses  cache-references
+ *   cache-misses  l1d-load-misses  llc-load-misses  dtlb-load-misses
+ *
+ * and the software event page-faults, which the kernel counts even
+ * where the hardware events are unavailable, as in most virtual
+ * machines.
+ *
+ * Each event is opened on its own, rather than as a group, so that
+ * the kernel can multiplex more events than the PMU has counters;
+ * counts are scaled up by the fraction of the time each was running.
+ *
+ * Events which cannot be opened, because the hardware lacks them or
+ * perf_event_paranoid or a container forbids them, are dropped with a
+ * warning, so the benchmarks still run with whatever is left, which
+ * may be nothing.  On systems other than Linux nothing is counted.
+\******************************************************************************/
+
+class PerfCounters {
+  struct Event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+  struct Counter {
+    std::string name;
+    int fd;
+    uint64_t start[3];
+  };
+
+  std::vector<Counter> counters_;
+
+#ifdef __linux__
+  static uint64_t cache(uint64_t id, uint64_t op, uint64_t result) {
+    return id | (op << 8) | (result << 16);
+  }
+#endif
+
+  static bool lookup(const std::string &name, Event &e) {
+#ifdef __linux__
+    const Event events[] = {
+      { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+      { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      { "cache-references", PERF_TYPE_HARDWARE,
+        PERF_COUNT_HW_CACHE_REFERENCES },
+      { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { "l1d-load-misses", PERF_TYPE_HW_CACHE,
+        cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+              PERF_COUNT_HW_CACHE_RESULT_MISS) },
+      { "llc-load-misses", PERF_TYPE_HW_CACHE,
+        cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+              PERF_COUNT_HW_CACHE_RESULT_MISS) },
+      { "dtlb-load-misses", PERF_TYPE_HW_CACHE,
+        cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+              PERF_COUNT_HW_CACHE_RESULT_MISS) },
+      { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    };
+    for(std::size_t i = 0; i < sizeof(events) / sizeof(events[0]); ++i) {
+      if(name == events[i].name) {
+        e = events[i];
+        return true;
+      }
+    }
+#endif
+    return false;
+  }
+
+  // Reads the count, time enabled and time running of c.
+  static bool read_counter(const Counter &c, uint64_t v[3]) {
+#ifdef __linux__
+    return ::read(c.fd, v, 3 * sizeof(uint64_t)) ==
+      ssize_t(3 * sizeof(uint64_t));
+#else
+    return false;
+#endif
+  }
+
+public:
+  // The events counted by --counters=default.
+  static const char *defaults() {
+    return "cycles,instructions,branch-misses,cache-misses,dtlb-load-misses";
+  }
+
+  // Whether name is one of the events above.
+  static bool known(const std::string &name) {
+    Event e;
+    return lookup(name, e);
+  }
+
+  // Opens the named events, all of which must be known().
+  explicit PerfCounters(const std::vector<std::string> &names) {
+#ifdef __linux__
+    for(std::size_t i = 0; i < names.size(); ++i) {
+      Event e;
+      if(!lookup(names[i], e)) continue;
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = e.type;
+      attr.config = e.config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if(fd < 0) {
+        std::cerr << "WARNING: cannot count " << names[i] << ": "
+                  << strerror(errno) << std::endl;
+        continue;
+      }
+      Counter c;
+      c.name = names[i];
+      c.fd = fd;
+      memset(c.start, 0, sizeof(c.start));
+      counters_.push_back(c);
+    }
+#endif
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() {
+#ifdef __linux__
+    for(std::size_t i = 0; i < counters_.size(); ++i) close(counters_[i].fd);
+#endif
+  }
+
+  // Number of events being counted.
+  std::size_t size() const { return counters_.size(); }
+  const std::string &name(std::size_t i) const { return counters_[i].name; }
+
+  void start() {
+#ifdef __linux__
+    for(std::size_t i = 0; i < counters_.size(); ++i) {
+      Counter &c = counters_[i];
+      ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+      if(!read_counter(c, c.start)) memset(c.start, 0, sizeof(c.start));
+    }
+#endif
+  }
+
+  // Stops counting and returns the number of each event since
+  // start(), scaled for the time it was multiplexed out.
+  std::vector<double> stop() {
+    std::vector<double> counts(counters_.size(), 0.0);
+#ifdef __linux__
+    for(std::size_t i = 0; i < counters_.size(); ++i) {
+      Counter &c = counters_[i];
+      uint64_t v[3];
+      bool ok = read_counter(c, v);
+      ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+      if(!ok) continue;
+      double count = double(v[0] - c.start[0]);
+      double enabled = double(v[1] - c.start[1]);
+      double running = double(v[2] - c.start[2]);
+      counts[i] = running > 0.0 ? count * enabled / running : 0.0;
+    }
+#endif
+    return counts;
+  }
+};
+
+/******************************************************************************/
+#endif
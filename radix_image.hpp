@@ -0,0 +1,178 @@
+#ifndef RADIX_IMAGE_HPP
+#define RADIX_IMAGE_HPP
+/******************************************************************************\
+ * Radix Tree Images
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <stdexcept>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Radix Tree Image.  A snapshot of a RadixTree in a file, laid out so
+ * that it can be searched where it is mapped, without being read or
+ * rebuilt.
+ *
+ * The file is a sequence of 4 KB pages.  The first is a header,
+ *
+ *   magic "VMRADIX1", table count, mapping count, root offset
+ *
+ * (each a 64-bit word in host byte order), and each of the others is
+ * one table of the tree, exactly as in memory except that an entry
+ * pointing to a table below holds the byte offset of that table in
+ * the file where the tree has its address.  Offsets are multiples of
+ * 4 KB, so they fit in the same 40-bit field, and the image is
+ * position-independent.
+ *
+ * write() saves a tree in one pass, writing every table after the
+ * tables below it so that their offsets are known, and the p4 table
+ * last.  A tree which shares tables with its forks is saved whole,
+ * with a copy of each shared table.
+ *
+ * Opening an image only maps it and checks its header; the kernel
+ * pages tables in as lookups reach them.  The image is trusted: the
+ * offsets in it are not checked by find().  It is mapped read-only and
+ * private, so the tree cannot be changed in place; a writer would
+ * have to rebuild it, or map it writable and let the kernel copy the
+ * pages it touches.
+\******************************************************************************/
+
+class RadixTreeImage {
+  typedef RadixTree::Table Table;
+  static const size_t page_bytes = sizeof(Table);
+
+  struct Header {
+    char magic[8];
+    uint64_t tables;
+    uint64_t size;
+    uint64_t root;
+  };
+
+  const char *data_;
+  size_t bytes_;
+  Header header_;
+
+  const Table *table(uint64_t e) const {
+    return reinterpret_cast<const Table*>(data_ + (e & RadixTree::ADDR_MASK));
+  }
+
+  // Writes the table at the given level after everything below it,
+  // counting pages in next, and returns its offset.
+  static uint64_t write_table(FILE *f, Table *t, unsigned level,
+                              uint64_t &next) {
+    Table copy;
+    memcpy(&copy, t, sizeof(Table));
+    for(size_t i = RadixTree::next_entry(t, 0);
+        level > 1 && i < RadixTree::table_size;
+        i = RadixTree::next_entry(t, i + 1)) {
+      uint64_t e = t->e[i];
+      if(RadixTree::is_leaf(e, level)) continue;
+      uint64_t off = write_table(f, RadixTree::entry_table(e), level - 1,
+                                 next);
+      copy.e[i] = off | (e & ~RadixTree::ADDR_MASK);
+    }
+    if(fwrite(&copy, sizeof(Table), 1, f) != 1)
+      throw std::runtime_error("radix image write failed");
+    return next++ * page_bytes;
+  }
+
+public:
+  static const char *magic() { return "VMRADIX1"; }
+
+  // Saves rt to the file at path.  Throws std::runtime_error if it
+  // cannot be written.
+  static void write(RadixTree &rt, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL)
+      throw std::runtime_error(std::string("cannot write ") + path);
+    char page[page_bytes];
+    memset(page, 0, sizeof(page));
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic(), sizeof(h.magic));
+    h.size = rt.size();
+    // Tables start after the header page
+    uint64_t next = 1;
+    try {
+      if(fwrite(page, sizeof(page), 1, f) != 1)
+        throw std::runtime_error("radix image write failed");
+      h.root = write_table(f, rt.t_, 4, next);
+      h.tables = next - 1;
+      memcpy(page, &h, sizeof(h));
+      if(fseek(f, 0, SEEK_SET) != 0 || fwrite(page, sizeof(page), 1, f) != 1)
+        throw std::runtime_error("radix image write failed");
+    } catch(...) {
+      fclose(f);
+      throw;
+    }
+    if(fclose(f) != 0)
+      throw std::runtime_error(std::string("cannot write ") + path);
+  }
+
+  // Maps the image at path.  Throws std::runtime_error if it cannot be
+  // mapped or is not an image.
+  explicit RadixTreeImage(const char *path) : data_(NULL), bytes_(0) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) throw std::runtime_error(std::string("cannot open ") + path);
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error(std::string("cannot stat ") + path);
+    }
+    bytes_ = st.st_size;
+    if(bytes_ < 2 * page_bytes) {
+      close(fd);
+      throw std::runtime_error(std::string(path) + ": not a radix image");
+    }
+    void *p = mmap(NULL, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open.
+    close(fd);
+    if(p == MAP_FAILED)
+      throw std::runtime_error(std::string("cannot map ") + path);
+    data_ = static_cast<const char*>(p);
+    memcpy(&header_, data_, sizeof(header_));
+    if(memcmp(header_.magic, magic(), sizeof(header_.magic)) != 0 ||
+       (header_.tables + 1) * page_bytes != bytes_ ||
+       header_.root % page_bytes != 0 || header_.root >= bytes_ ||
+       header_.root < page_bytes) {
+      munmap(const_cast<char*>(data_), bytes_);
+      throw std::runtime_error(std::string(path) + ": not a radix image");
+    }
+  }
+  RadixTreeImage(const RadixTreeImage&) = delete;
+  RadixTreeImage& operator=(const RadixTreeImage&) = delete;
+  ~RadixTreeImage() { munmap(const_cast<char*>(data_), bytes_); }
+
+  // As RadixTree::find(), on the mapped tables.
+  RadixTreeIterator find(uint64_t vadd) const {
+    uint64_t e = table(header_.root)->e[RadixTree::key<4>(vadd)];
+    for(unsigned level = 3; level > 0; --level) {
+      if(!(e & RadixTree::PRESENT)) return end();
+      unsigned shift = RadixTree::page_shift(level);
+      e = table(e)->e[(vadd >> shift) & (RadixTree::table_size - 1)];
+      if(RadixTree::is_leaf(e, level) && (e & RadixTree::PRESENT)) {
+        return RadixTreeIterator(vadd, (e & RadixTree::ADDR_MASK) |
+                                 (vadd & RadixTree::page_mask(level)));
+      }
+    }
+    return end();
+  }
+
+  RadixTreeIterator end() const { return RadixTreeIterator(-1, -1, true); }
+
+  size_t size() const { return header_.size; }
+  size_t tables() const { return header_.tables; }
+  size_t bytes() const { return bytes_; }
+};
+
+/******************************************************************************/
+#endif
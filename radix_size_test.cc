@@ -5,236 +5,505 @@
  * http://www.boost.org/doc/libs/1_60_0/doc/html/intrusive/avl_set_multiset.html
 \******************************************************************************/
 
-#include <boost/intrusive/rbtree.hpp>
-#include <boost/intrusive/avltree.hpp>
-#include <boost/intrusive/splaytree.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
 #include <vector>
 #include <functional>
 #include <cassert>
 #include <random>
 #include <cstdint>
-#include "radixtree.hpp"
-
-using namespace boost::intrusive;
-using namespace boost::posix_time;
+#include <fstream>
+#include <new>
+#include <cstdlib>
+#include <memory>
+#include <unistd.h>
+#include "containers.hpp"
+#include "radix_image.hpp"
+#include "nested.hpp"
+#include "workload.hpp"
+#include "bench.hpp"
 
 /******************************************************************************/
 
-class MemoryMapping : public set_base_hook<optimize_size<false> >,
-                      public avl_set_base_hook<optimize_size<false> >,
-                      public bs_set_base_hook<optimize_size<false> >
-{
-  std::uint64_t va_;
-  std::uint64_t pa_;
+template<class Iterator>
+void test_insertion(MemoryContainer<Iterator> &c,
+                    const char *ContainerName,
+                    std::vector<MemoryMapping> &values,
+                    std::vector<MemoryMapping> &lookups,
+                    const BenchOptions &o,
+                    Reporter &report) {
+  bench_insert_search(report, o, ContainerName, values.size(), lookups.size(),
+                      [&]() { c.clear(); },
+                      [&](std::size_t i) { c.insert(values[i]); },
+                      [&](std::size_t i) {
+                        return c.end() != c.find(lookups[i]);
+                      });
+  if(c.size() != values.size()){
+    std::cerr << "    ERROR: size not consistent" << std::endl;
+  }
+  c.clear();
+}
 
-public:
-  set_member_hook<> member_hook_;
+// Every allocation through operator new is counted.  The radix
+// tree's slabs come from posix_memalign and are not, but its
+// memory_bytes() accounts for them.
+std::size_t numAllocs = 0;
 
-  MemoryMapping(uint64_t va, uint64_t pa) : va_(va), pa_(pa) {}
+void *operator new(std::size_t n) {
+  ++numAllocs;
+  void *p = std::malloc(n == 0 ? 1 : n);
+  if(p == NULL) throw std::bad_alloc();
+  return p;
+}
 
-  std::uint64_t getVA() { return va_; }
-  std::uint64_t getPA() { return pa_; }
+void *operator new[](std::size_t n) { return operator new(n); }
 
-  friend bool operator< (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ < b.va_; }
-  friend bool operator> (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ > b.va_; }
-  friend bool operator== (const MemoryMapping &a, const MemoryMapping &b)
-  { return a.va_ == b.va_; }  
-};
+// GCC warns once these are inlined into callers which it sees
+// allocating with new, not knowing that new above is malloc.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
 
-// Define trees using the base hook
-typedef rbtree<    MemoryMapping, compare<std::less<MemoryMapping> > >     RBTree;
-typedef avltree<   MemoryMapping, compare<std::less<MemoryMapping> > >     AVLTree;
-typedef splaytree< MemoryMapping, compare<std::less<MemoryMapping> > >     SplayTree;
+void operator delete(void *p) noexcept { std::free(p); }
 
-/******************************************************************************/
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
 
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// Resident set size of this process in bytes, or 0 where
+// /proc/self/statm is not available.
+std::size_t rss_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  std::size_t total = 0, resident = 0;
+  if(!(statm >> total >> resident)) return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Fills the container once more, untimed, and reports its memory use
+// per mapping, the allocations per mapping made while filling it, and
+// the growth in RSS, which is negative if memory released earlier was
+// returned to the system meanwhile.
 template<class Iterator>
-class MemoryContainer {
-public:
-  virtual void insert(MemoryMapping&) = 0;
-  virtual Iterator end() = 0;
-  virtual Iterator find(MemoryMapping&) = 0;
-  virtual void clear() = 0;
-  virtual std::size_t size() = 0;
-};
-
-class RBTreeContainer : public MemoryContainer<RBTree::iterator> {
-
-  RBTree rbt_;
-
-public:
-  RBTreeContainer() : rbt_() {}
-  void insert(MemoryMapping& mm) { rbt_.insert_unique(mm); }
-  RBTree::iterator end() { return rbt_.end(); }
-  RBTree::iterator find(MemoryMapping& mm) { return rbt_.find(mm); }
-  void clear() { rbt_.clear(); }
-  std::size_t size() { return rbt_.size(); }
-};
-
-class AVLTreeContainer : public MemoryContainer<AVLTree::iterator> {
-  AVLTree avlt_;
-
-public:
-  AVLTreeContainer() : avlt_() {}
-  void insert(MemoryMapping& mm) {avlt_.insert_unique(mm); }
-  AVLTree::iterator end() { return avlt_.end(); }
-  AVLTree::iterator find(MemoryMapping& mm) { return avlt_.find(mm); }
-  void clear() { avlt_.clear(); }
-  std::size_t size() { return avlt_.size(); }
-};
-
-class SplayTreeContainer : public MemoryContainer<SplayTree::iterator> {
-  SplayTree splayt_;
-
-public:
-  SplayTreeContainer() : splayt_() {}
-  void insert(MemoryMapping& mm) {splayt_.insert_unique(mm); }
-  SplayTree::iterator end() { return splayt_.end(); }
-  SplayTree::iterator find(MemoryMapping& mm) { return splayt_.find(mm); }
-  void clear() { splayt_.clear(); }
-  std::size_t size() { return splayt_.size(); }
-};
-
-class RadixTreeContainer : public MemoryContainer<RadixTreeIterator> {
-  RadixTree radixt_;
-
-public:
-  RadixTreeContainer() : radixt_() {}
-  void insert(MemoryMapping& mm) {radixt_.insert(mm.getVA(), mm.getPA()); }
-  RadixTreeIterator end() { return radixt_.end(); }
-  RadixTreeIterator find(MemoryMapping& mm) {
-    return radixt_.find(mm.getVA());
+void test_memory(MemoryContainer<Iterator> &c,
+                 const char *ContainerName,
+                 std::vector<MemoryMapping> &values,
+                 Reporter &report) {
+  c.clear();
+  std::size_t rssBefore = rss_bytes(), allocs = numAllocs;
+  for(std::size_t i = 0, max = values.size(); i != max; ++i) {
+    c.insert(values[i]);
   }
-  void clear() { radixt_.clear(); }
-  std::size_t size() { return radixt_.size(); }
-};
+  std::size_t n = values.size();
+  // Read both before reporting, which may allocate
+  allocs = numAllocs - allocs;
+  double rss = double(rss_bytes()) - double(rssBefore);
+  report.value(ContainerName, "bytes-per-mapping", n, "bytes",
+               double(c.memory_bytes()) / double(n));
+  report.value(ContainerName, "allocs-per-mapping", n, "count",
+               double(allocs) / double(n));
+  report.value(ContainerName, "rss-growth", n, "bytes", rss);
+  c.clear();
+}
 
-/******************************************************************************/
+/******************************************************************************\
+ * Maps a physically contiguous heap of heapBytes bytes into a radix
+ * tree using pages of the given size, then looks up random addresses
+ * within it.  Reports the number of mappings and tables, and the
+ * table memory, alongside the usual insert and search times.
+\******************************************************************************/
 
-template<class Iterator>
-void test_insertion(MemoryContainer<Iterator> &c,
-                    std::vector<MemoryMapping> &values,
-                    std::size_t numRepeat) {
-  ptime tini, tend;
-  std::vector<double> times;
-  // Insert
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      c.clear();
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        c.insert(values[i]);
-      }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())
-                      /double(values.size()));
-      //std::cout << "," << times.back();
-      if(c.size() != values.size()){
-        std::cerr << "    ERROR: size not consistent" << std::endl;
-      }
-    }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
-    }
-    std::cout << "," << total/numRepeat;
+void test_page_size(RadixTree::PageSize ps,
+                    const char *PageSizeName,
+                    uint64_t heapBytes,
+                    std::vector<uint64_t> &lookups,
+                    const BenchOptions &o,
+                    Reporter &report) {
+  const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+  const uint64_t pageBytes = 1ULL << (12 + 9 * (ps - 1));
+  const std::size_t numPages = heapBytes / pageBytes;
+  const std::string name = std::string("Radix Tree ") + PageSizeName;
+  RadixTree rt;
+  bench_insert_search(report, o, name, numPages, lookups.size(),
+                      [&]() { rt.clear(); },
+                      [&](std::size_t i) {
+                        rt.insert(vbase + i * pageBytes, pbase + i * pageBytes,
+                                  ps);
+                      },
+                      [&](std::size_t i) {
+                        return *rt.find(lookups[i]) ==
+                          lookups[i] - vbase + pbase;
+                      });
+  report.value(name, "tables", numPages, "count", rt.tables());
+  report.value(name, "table-bytes", numPages, "bytes", rt.tables() * 4096);
+}
+
+/******************************************************************************\
+ * Forks a radix tree holding the given mappings.  Reports the time to
+ * fork it, the time of the first write into the child, which copies
+ * the shared tables above the page written, and the time per page to
+ * rewrite every mapping of a fresh child, with the tables copied.
+\******************************************************************************/
+
+void test_fork(std::vector<MemoryMapping> &values,
+               const BenchOptions &o,
+               Reporter &report) {
+  const std::size_t n = values.size();
+  RadixTree rt;
+  for(std::size_t i = 0; i != n; ++i) {
+    rt.insert(values[i].getVA(), values[i].getPA());
   }
-  // Search
-  {
-    for( std::size_t repeat = 0, repeat_max = numRepeat
-           ; repeat != repeat_max
-           ; ++repeat){
-      std::size_t found = 0;
-      tini = microsec_clock::universal_time();
-      for( std::size_t i = 0, max = values.size()
-             ; i != max
-             ; ++i){
-        found += static_cast<std::size_t>(c.end() != c.find(values[i]));
-      }
-      tend = microsec_clock::universal_time();
-      times.push_back(double((tend-tini).total_nanoseconds())/
-                      double(values.size()));
-      //std::cout << "," << times.back();
-      if(found != values.size()){
-        std::cerr << "    ERROR: not all found, "
-                  << found << " found out of " << values.size()
-                  << std::endl;
-      }
-    }
-    double total = 0.0;
-    while(!times.empty()) {
-      total += times.back();
-      times.pop_back();
-    }
-    std::cout << "," << total/numRepeat;
+  std::unique_ptr<RadixTree> child;
+  report.row("Radix Tree", "fork", n, "ns/fork",
+             measure(o, 1, [&]() { child.reset(); },
+                     [&]() { child = rt.fork(); }));
+  report.row("Radix Tree", "first-write", n, "ns/op",
+             measure(o, 1, [&]() { child.reset(); child = rt.fork(); },
+                     [&]() {
+                       child->insert(values[0].getVA(), values[0].getPA());
+                     }));
+  report.row("Radix Tree", "cow-rewrite", n, "ns/op",
+             measure(o, n, [&]() { child.reset(); child = rt.fork(); },
+                     [&]() {
+                       for(std::size_t i = 0; i != n; ++i) {
+                         child->insert(values[i].getVA(), values[i].getPA());
+                       }
+                     }));
+  // The parent's tables, then its own and the child's together
+  const std::size_t tables = rt.tables();
+  child.reset();
+  report.value("Radix Tree", "cow-tables-copied", n, "count",
+               tables - rt.tables());
+}
+
+/******************************************************************************\
+ * Time to first lookup: building a radix tree from the given mappings
+ * and searching it once, against mapping a saved image of the same
+ * tree and searching that once.  The image was just written, so its
+ * pages are in the page cache, as they would be for a service which
+ * restarts.  Also reports the time of every lookup on the image, and
+ * its size.
+\******************************************************************************/
+
+void test_image(std::vector<MemoryMapping> &values,
+                std::vector<MemoryMapping> &lookups,
+                const BenchOptions &o,
+                Reporter &report) {
+  const std::size_t n = values.size();
+  std::unique_ptr<RadixTree> rt;
+  bool found = false;
+  report.row("Radix Tree", "rebuild-first-lookup", n, "ns",
+             measure(o, 1, [&]() { rt.reset(); }, [&]() {
+                 rt.reset(new RadixTree());
+                 for(std::size_t i = 0; i != n; ++i) {
+                   rt->insert(values[i].getVA(), values[i].getPA());
+                 }
+                 found = rt->find(lookups[0].getVA()).isValid();
+               }));
+  char path[] = "/tmp/radix_image_XXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0) {
+    std::cerr << "    ERROR: cannot create an image file" << std::endl;
+    return;
   }
-  c.clear();
+  close(fd);
+  RadixTreeImage::write(*rt, path);
+  rt.reset();
+  std::unique_ptr<RadixTreeImage> image;
+  report.row("Radix Tree Image", "mmap-first-lookup", n, "ns",
+             measure(o, 1, [&]() { image.reset(); }, [&]() {
+                 image.reset(new RadixTreeImage(path));
+                 found = found && image->find(lookups[0].getVA()).isValid();
+               }));
+  std::size_t hits = 0;
+  report.row("Radix Tree Image", "search", n, "ns/op",
+             measure(o, lookups.size(), [&]() { hits = 0; }, [&]() {
+                 for(std::size_t i = 0, max = lookups.size(); i != max; ++i) {
+                   hits += image->find(lookups[i].getVA()).isValid();
+                 }
+               }));
+  if(!found || hits != lookups.size()) {
+    std::cerr << "    ERROR: image lookups failed" << std::endl;
+  }
+  report.value("Radix Tree Image", "image-bytes", n, "bytes", image->bytes());
+  image.reset();
+  unlink(path);
+}
+
+/******************************************************************************\
+ * Two-dimensional translation: a guest radix tree maps the given
+ * virtual addresses to guest physical pages, laid out contiguously
+ * well away from the heap, and a host radix tree maps those pages,
+ * and the guest's own tables, to host memory.  Reports the time per
+ * translation and the references per translation without caches,
+ * with a nested TLB, with a guest page-walk cache, and with both.
+\******************************************************************************/
+
+void test_nested(std::vector<MemoryMapping> &values,
+                 std::vector<MemoryMapping> &lookups,
+                 const BenchOptions &o,
+                 Reporter &report) {
+  const uint64_t gpaBase = 1ULL << 40;
+  const std::size_t n = values.size();
+  RadixTree guest, host;
+  for(std::size_t i = 0; i != n; ++i) {
+    guest.insert(values[i].getVA(), gpaBase + (i << 12));
+    host.insert(gpaBase + (i << 12), values[i].getPA());
+  }
+  NestedWalk(guest, host).map_guest_tables();
+
+  const struct { const char *name; std::size_t ntlb, pwc; } configs[] = {
+    { "Nested Walk", 0, 0 },
+    { "Nested Walk + NTLB", 1024, 0 },
+    { "Nested Walk + PWC", 0, 32 },
+    { "Nested Walk + NTLB + PWC", 1024, 32 },
+  };
+  for(const auto &c : configs) {
+    NestedWalk walk(guest, host, c.ntlb, c.pwc);
+    std::size_t hits = 0;
+    report.row(c.name, "search", n, "ns/op",
+               measure(o, lookups.size(), [&]() {
+                   hits = 0;
+                   walk.flush();
+                   walk.reset_counters();
+                 }, [&]() {
+                   for(std::size_t i = 0, max = lookups.size(); i != max;
+                       ++i) {
+                     hits += walk.translate(lookups[i].getVA()) ==
+                       lookups[i].getPA();
+                   }
+                 }));
+    if(hits != lookups.size()) {
+      std::cerr << "    ERROR: " << c.name << " found " << hits << " of "
+                << lookups.size() << std::endl;
+    }
+    const NestedWalk::Counters &k = walk.counters();
+    report.value(c.name, "refs-per-translation", n, "refs",
+                 walk.references());
+    report.value(c.name, "host-refs-per-translation", n, "refs",
+                 double(k.host_refs) / double(k.translations));
+  }
+}
+
+/******************************************************************************\
+ * Lookups in a radix tree with and without its paging-structure
+ * cache, which pays off when lookups cluster in the address space.
+ * Reports the time per lookup and, for the cache, the fraction of
+ * walks starting at a cached p1, p2 or p3 table.
+\******************************************************************************/
+
+void test_walk_cache(std::vector<MemoryMapping> &values,
+                     std::vector<MemoryMapping> &lookups,
+                     const BenchOptions &o,
+                     Reporter &report) {
+  const std::size_t n = values.size();
+  RadixTree rt;
+  for(std::size_t i = 0; i != n; ++i) {
+    rt.insert(values[i].getVA(), values[i].getPA());
+  }
+  for(std::size_t entries = 0; entries <= 32; entries += 32) {
+    const char *name = entries ? "Radix Tree + PSC" : "Radix Tree";
+    rt.set_walk_cache(entries);
+    std::size_t hits = 0;
+    report.row(name, "search", n, "ns/op",
+               measure(o, lookups.size(), [&]() {
+                   hits = 0;
+                   rt.set_walk_cache(entries);
+                 }, [&]() {
+                   for(std::size_t i = 0, max = lookups.size(); i != max;
+                       ++i) {
+                     hits += rt.find(lookups[i].getVA()).isValid();
+                   }
+                 }));
+    if(hits != lookups.size()) {
+      std::cerr << "    ERROR: " << name << " found " << hits << " of "
+                << lookups.size() << std::endl;
+    }
+  }
+  const double walks = double(rt.walk_cache_lookups());
+  report.value("Radix Tree + PSC", "p1-hit-rate", n, "ratio",
+               rt.walk_cache_hits(1) / walks);
+  report.value("Radix Tree + PSC", "p2-hit-rate", n, "ratio",
+               rt.walk_cache_hits(2) / walks);
+  report.value("Radix Tree + PSC", "p3-hit-rate", n, "ratio",
+               rt.walk_cache_hits(3) / walks);
+}
+
+/******************************************************************************\
+ * Whole-tree walks which skip empty entries by the tables' occupancy
+ * bitmaps: visiting every mapping in address order, visiting those in
+ * the lower half of the mappings' address range, and tearing the tree
+ * down one table at a time, as clear() does for a tree sharing its
+ * pool with a fork.  Reported per mapping.
+\******************************************************************************/
+
+void test_scan(std::vector<MemoryMapping> &values,
+               const BenchOptions &o,
+               Reporter &report) {
+  const std::size_t n = values.size();
+  RadixTree rt;
+  uint64_t lo = ~0ULL, hi = 0;
+  for(std::size_t i = 0; i != n; ++i) {
+    rt.insert(values[i].getVA(), values[i].getPA());
+    lo = std::min(lo, values[i].getVA());
+    hi = std::max(hi, values[i].getVA());
+  }
+  std::size_t seen = 0;
+  report.row("Radix Tree", "iterate", n, "ns/op",
+             measure(o, n, [&]() { seen = 0; }, [&]() {
+                 for(RadixTree::iterator it = rt.begin(); it.isValid(); ++it)
+                   ++seen;
+               }));
+  if(seen != n) {
+    std::cerr << "    ERROR: iterated " << seen << " of " << n << std::endl;
+  }
+  const uint64_t mid = lo + (hi - lo) / 2;
+  auto ignore = [](uint64_t, uint64_t) {};
+  const std::size_t inRange = rt.for_each_in_range(lo, mid, ignore);
+  report.row("Radix Tree", "range-scan", n, "ns/op",
+             measure(o, std::max<std::size_t>(inRange, 1), []() {}, [&]() {
+                 seen = rt.for_each_in_range(lo, mid, ignore);
+               }));
+  if(seen != inRange) {
+    std::cerr << "    ERROR: range scan saw " << seen << " of " << inRange
+              << std::endl;
+  }
+  std::unique_ptr<RadixTree> child;
+  report.row("Radix Tree", "teardown", n, "ns/op",
+             measure(o, n, [&]() {
+                 // Leave the child the only owner of the shared tables
+                 child = rt.fork();
+                 rt.clear();
+                 for(std::size_t i = 0; i != n; ++i) {
+                   rt.insert(values[i].getVA(), values[i].getPA());
+                 }
+               }, [&]() { child->clear(); }));
 }
 
 /******************************************************************************/
 
 
-int main() {
+int main(int argc, char **argv) {
 
 #ifdef NDEBUG
-  const std::size_t numElem = 1000000;
-  const std::size_t step = numElem / 20;
-  const std::size_t numRepeat = 30;
+  BenchOptions o(1000000, 30);
+  const std::size_t steps = 20;
 #else
-  const std::size_t numElem = 10000;
-  const std::size_t step = numElem / 5;
-  const std::size_t numRepeat = 4;
+  BenchOptions o(10000, 4);
+  const std::size_t steps = 5;
 #endif
-  
-  std::random_device device;
-  std::mt19937 generator(device());
+
+  Workload workload;
+  for(int i = 1; i < argc; ++i) {
+    if(!workload.parse(argv[i]) && !o.parse(argv[i])) {
+      std::cerr << "Usage: " << argv[0] << " " << BenchOptions::usage()
+                << " " << Workload::usage() << std::endl
+                << "Containers: radix hashed swiss bplus rb avl splay"
+                << " fork image nested psc scan pagesize"
+                << std::endl;
+      return 1;
+    }
+  }
+  std::cerr << "Workload: " << workload.describe() << std::endl;
+
+  const std::size_t numElem = o.elements;
+  const std::size_t step = std::max<std::size_t>(numElem / steps, 1);
+  std::mt19937 generator(workload.seed);
   std::uniform_int_distribution<uint64_t>
     dist(0, std::numeric_limits<uint64_t>::max());
-  std::vector<MemoryMapping> values;
-  std::srand(0);
-  
-  std::cout << "nElements,Radix-Insert,Radix-Search,Red-Black-Insert,Red-Black-Search,AVL-Insert,AVL-Search,Splay-Insert,Splay-Search" << std::endl;
-  
-  while(values.size() <= numElem) {
-    for(uint64_t j = 0; j < step; ++j) {
-      // Create several MemoryMapping objects, each one with a different value
-      uint64_t vadd = correctify_vadd(dist(generator));
-      uint64_t padd = correctify_padd(vadd, dist(generator));
-      values.push_back(MemoryMapping(vadd, padd));
-    }
-    // Randomize the order
-    std::random_shuffle(values.begin(), values.end());
-    std::cout << values.size();
-    {
+  // Every size below takes a prefix of the same mappings, so that
+  // clustered workloads grow the same address space.
+  std::vector<MemoryMapping> all;
+  workload.mappings(numElem, all);
+
+  Reporter report(o);
+  for(std::size_t n = step; n <= numElem; n += step) {
+    std::vector<MemoryMapping> values(all.begin(), all.begin() + n);
+    std::vector<MemoryMapping> lookups;
+    workload.order_inserts(values);
+    workload.lookups(values, n, lookups);
+    if(o.selected("radix")) {
       RadixTreeContainer radixtc;
-      test_insertion(radixtc, values, numRepeat);
+      test_memory(radixtc, "Radix Tree", values, report);
+      test_insertion(radixtc, "Radix Tree", values, lookups, o, report);
+    }
+
+    if(o.selected("hashed")) {
+      HashedPageTableContainer hashptc;
+      test_memory(hashptc, "Hashed Page Table", values, report);
+      test_insertion(hashptc, "Hashed Page Table", values, lookups, o,
+                     report);
+    }
+
+    if(o.selected("swiss")) {
+      SwissTableContainer swisstc;
+      test_memory(swisstc, "Swiss Table", values, report);
+      test_insertion(swisstc, "Swiss Table", values, lookups, o, report);
     }
 
-    {
+    if(o.selected("bplus")) {
+      BPlusTreeContainer<16> bplustc;
+      test_memory(bplustc, "B+ Tree (16)", values, report);
+      test_insertion(bplustc, "B+ Tree (16)", values, lookups, o, report);
+    }
+
+    if(o.selected("fork")) {
+      test_fork(values, o, report);
+    }
+
+    if(o.selected("image")) {
+      test_image(values, lookups, o, report);
+    }
+
+    if(o.selected("nested")) {
+      test_nested(values, lookups, o, report);
+    }
+
+    if(o.selected("psc")) {
+      test_walk_cache(values, lookups, o, report);
+    }
+
+    if(o.selected("scan")) {
+      test_scan(values, o, report);
+    }
+
+    if(o.selected("rb")) {
       RBTreeContainer rbtc;
-      test_insertion(rbtc, values, numRepeat);
+      test_memory(rbtc, "Red-Black Tree", values, report);
+      test_insertion(rbtc, "Red-Black Tree", values, lookups, o, report);
     }
 
-    {
+    if(o.selected("avl")) {
       AVLTreeContainer avltc;
-      test_insertion(avltc, values, numRepeat);
+      test_memory(avltc, "AVL Tree", values, report);
+      test_insertion(avltc, "AVL Tree", values, lookups, o, report);
     }
 
-    {
+    if(o.selected("splay")) {
       SplayTreeContainer splaytc;
-      test_insertion(splaytc, values, numRepeat);
+      test_memory(splaytc, "Splay Tree", values, report);
+      test_insertion(splaytc, "Splay Tree", values, lookups, o, report);
     }
+  }
 
-    std::cout << std::endl;
+  // Large pages: the same heap mapped with 4 KB, 2 MB and 1 GB pages.
+  if(o.selected("pagesize")) {
+    // Whole number of gigabytes, at least enough for numElem 4 KB pages
+    const uint64_t gig = 1ULL << 30;
+    const uint64_t heapBytes = (numElem * 4096 + gig - 1) / gig * gig;
+    const uint64_t vbase = 0x7f0000000000;
+    std::vector<uint64_t> lookups;
+    for(std::size_t i = 0; i < numElem; ++i) {
+      lookups.push_back(vbase + dist(generator) % heapBytes);
+    }
+    test_page_size(RadixTree::PAGE_4K, "4K", heapBytes, lookups, o, report);
+    test_page_size(RadixTree::PAGE_2M, "2M", heapBytes, lookups, o, report);
+    test_page_size(RadixTree::PAGE_1G, "1G", heapBytes, lookups, o, report);
   }
-  
+
   return 0;
 }
@@ -7,6 +7,13 @@
 \******************************************************************************/
 
 #include <vector>
+#include <memory>
+#include <utility>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "pagetable.hpp"
 
 using namespace std;
 
@@ -32,22 +39,171 @@ public:
   uint64_t operator* () { return this->p_; }
 };
 
+/******************************************************************************\
+ * Table Pool.  Hands out page-aligned 4 KB pages for page tables,
+ * carved from 2 MB slabs which are allocated on demand and kept until
+ * the pool is destroyed.  Freed pages go on a free list threaded
+ * through their first word, and reset() returns every page to the
+ * pool at once, so that tearing down a tree costs a few stores rather
+ * than one free() per table.
+ *
+ * Like the kernel's struct page, each page has a Meta record for its
+ * owner's bookkeeping.  The records live in the first pages of each
+ * slab, which is aligned to its size, so that a page's record can be
+ * found from its address alone.  With a 512-bit occupancy bitmap in
+ * each, they take 9 of the 512 pages.
+\******************************************************************************/
+
+class TablePool {
+public:
+  static const size_t page_bytes = 4096;
+  static const size_t slab_bytes = 2 * 1024 * 1024;
+  static const size_t slab_pages = slab_bytes / page_bytes;
+
+  struct Meta {
+    uint64_t occupied[8];   // Bit i set if entry i of the table is present
+    uint32_t shares;        // Entries pointing here beyond the first
+  };
+
+  static const size_t meta_pages =
+    (sizeof(Meta) * slab_pages + page_bytes - 1) / page_bytes;
+  static const size_t usable_pages = slab_pages - meta_pages;
+
+  // Zeroed along with the page by alloc().
+  static Meta &meta(void *p) {
+    uintptr_t a = reinterpret_cast<uintptr_t>(p);
+    Meta *m = reinterpret_cast<Meta*>(a & ~(uintptr_t)(slab_bytes - 1));
+    return m[(a & (slab_bytes - 1)) / page_bytes];
+  }
+
+private:
+  vector<char*> slabs_;
+  size_t next_;   // Pages handed out from the slabs, not counting frees
+  void *free_;    // Free list of recycled pages
+  size_t live_;   // Pages currently allocated
+
+public:
+  TablePool() : slabs_(), next_(0), free_(NULL), live_(0) {}
+  TablePool(const TablePool&) = delete;
+  TablePool& operator=(const TablePool&) = delete;
+  ~TablePool() {
+    for(size_t i = 0; i < slabs_.size(); ++i) ::free(slabs_[i]);
+  }
+
+  // Returns a zeroed, page-aligned page.
+  void *alloc() {
+    void *p = free_;
+    if(p != NULL) {
+      free_ = *static_cast<void**>(p);
+    } else {
+      if(next_ == slabs_.size() * usable_pages) {
+        void *slab = NULL;
+        if(posix_memalign(&slab, slab_bytes, slab_bytes) != 0)
+          throw std::bad_alloc();
+        slabs_.push_back(static_cast<char*>(slab));
+      }
+      p = slabs_[next_ / usable_pages] +
+        (meta_pages + next_ % usable_pages) * page_bytes;
+      ++next_;
+    }
+    memset(p, 0, page_bytes);
+    meta(p) = Meta();
+    ++live_;
+    return p;
+  }
+
+  void free(void *p) {
+    *static_cast<void**>(p) = free_;
+    free_ = p;
+    --live_;
+  }
+
+  // Frees every page at once.  The slabs are kept for reuse.
+  void reset() {
+    next_ = 0;
+    free_ = NULL;
+    live_ = 0;
+  }
+
+  size_t live() { return live_; }
+  size_t slabs() { return slabs_.size(); }
+  // Memory held by the pool: its slabs, including their Meta pages and
+  // any free pages, and the slab list.
+  size_t bytes() {
+    return slabs_.size() * slab_bytes + slabs_.capacity() * sizeof(char*);
+  }
+};
+
 /******************************************************************************\
  * Radix Tree.  This implementation is designed as a mock-up of x86-64
- * page tables.  However, in a real implementation all table base
- * addresses would be page-aligned, and therefore require only 40 bits
- * to encode (since the low-order bits would just be 0).  This is
- * simply a mock-up and doesn't page-align anything, and neither does
- * it encode meta-information bits.  The purpose of this
- * implementation is simply to test the speed of virtual->physical
- * address mappings in a radix tree similar to the one used in a page table.
+ * page tables.  Every table is a page-aligned, 4 KB array of 512
+ * 64-bit entries, so that a table base address requires only 40 bits
+ * to encode and the low-order bits are free for meta-information.
+ * As in hardware, an entry in the p3 or p2 table may either point to
+ * the next table down or, with the PS bit set, directly map a 1 GB or
+ * 2 MB page, so that pages of all three sizes coexist in one tree.
+ * The purpose of this implementation is simply to test the speed of
+ * virtual->physical address mappings in a radix tree similar to the
+ * one used in a page table.
+ *
+ * fork() creates a copy-on-write clone.  Parent and child get their
+ * own p4 tables but share every table below, along with the pool they
+ * come from, and each table's Meta counts the entries in other tables
+ * which share it.  A write through a shared table first copies it,
+ * and on the way down every shared table above it, so that forking
+ * costs one table however many pages are mapped, and the first write
+ * below each p3 entry costs one table per level.
+ *
+ * Each table's Meta holds a bitmap of its present entries, so that
+ * walks over the whole tree (teardown, copying a table, iteration in
+ * address order from begin() or lower_bound()) find the next present
+ * entry with a count of trailing zeros, and cost time in proportion
+ * to the tables' live entries rather than their size.
+ *
+ * set_walk_cache() turns on a paging-structure cache, as in the MMU:
+ * three small direct-mapped arrays remembering the p3, p2 and p1
+ * tables of recent walks, keyed on the address bits above each.  A
+ * find() then starts at the deepest table cached for its address
+ * rather than at the p4 table, and counts where each walk started.
+ * Only table pointers are cached, never entries, so a write into a
+ * cached table needs no invalidation; insert() and erase() drop the
+ * tables cached for their address, since they may replace or free
+ * them, and clear(), inserting a 1 GB page or an erase_range() over
+ * more than one 2 MB region flushes the whole cache.  Slots are
+ * indexed by the low bits of the key, so a size which is not a power
+ * of two is rounded up to one.
  * 
 \******************************************************************************/
 
 class RadixTree {
-  vector< vector< vector< vector<uint64_t>* >* >* > t_;
+public:
+  // The level of the table holding the leaf entry for each page size.
+  enum PageSize { PAGE_4K = 1, PAGE_2M = 2, PAGE_1G = 3 };
+
+private:
+  // Saves and searches trees in files
+  friend class RadixTreeImage;
+  // Walks guest trees through host trees
+  friend class NestedWalk;
+
+  static const size_t table_size = 512;
+  struct Table { uint64_t e[table_size]; };
+
+  std::shared_ptr<TablePool> pool_;   // Shared with forks
+  Table *t_;
   size_t s_;
 
+  struct WalkCacheEntry {
+    uint64_t tag;   // Address bits above the table's level, or 0
+    Table *t;
+  };
+  // The paging-structure cache: psc_entries_ slots for p1 tables, then
+  // as many for p2 and for p3 tables.  Empty when disabled.
+  std::vector<WalkCacheEntry> psc_;
+  size_t psc_entries_;
+  size_t psc_lookups_;
+  size_t psc_hits_[3];
+
 /****************************************************************************\
  * A virtual address has the following form:
  *
@@ -62,118 +218,558 @@ class RadixTree {
  * significant 16 bits.  The 9 bits (47:39) of the p4 key give an
  * index into the first level of page tables, stored in t_, which
  * gives a pointer to the p3 table.  The 9 bits (38:30) of the p3 key
- * give an index into this table, and so on.  The p1 table entry gives
- * another 64-bit integer, with the following form:
+ * give an index into this table, and so on.  Every table entry is a
+ * 64-bit integer with the following form:
  *
  * 6  6         5         4         3         2         1         0
  * 3210987654321098765432109876543210987654321098765432109876543210
  * ----------------------------------------------------------------
  * |\_________/\______________________________________/\_/|||||||||
  * N  Avl.(11)      physical base address(40)           A GPDAPPURP
- * 
- * Everything is ignored except for the 40-bit physical base address
- * in bits 51:12, which is combined with the 12-bit offset given by
- * bits 11:0 of the virtual address, to give a 52-bit physical
- * address.
+ *                                                        S       
+ *
+ * Everything is ignored except for the present bit (P, bit 0), the
+ * page size bit (PS, bit 7) and the 40-bit base address in bits
+ * 51:12.  If PS is clear, the base address is that of the next
+ * table down.  Otherwise (and always in the p1 table) the entry maps
+ * a page, and the base address is combined with the low-order bits
+ * of the virtual address: the 12-bit offset for a 4 KB page, bits
+ * 20:0 for a 2 MB page, or bits 29:0 for a 1 GB page.
  *
 \****************************************************************************/
 
-  static uint16_t p4_key(uint64_t vadd) {
-    //               \/- 9 bits
-    uint64_t mask = 0b111111111;
-    return (vadd & (mask << (9 + 9 + 9 + 12)) >> (9 + 9 + 9 + 12));
+  // x86-64 4-level paging: a 12-bit offset and four 9-bit indices.
+  typedef PageTableLayout<12, 9, 9, 9, 9> layout;
+
+  template <unsigned Level>
+  static uint16_t key(uint64_t vadd) { return layout::index<Level>(vadd); }
+
+  static uint16_t offset(uint64_t vadd) { return layout::offset(vadd); }
+
+  static const uint64_t PRESENT = 1ULL << 0;
+  static const uint64_t PS = 1ULL << 7;
+  // Bits 51:12
+  static const uint64_t ADDR_MASK = 0x000ffffffffff000ULL;
+
+  // Number of low-order virtual address bits passed straight through
+  // by a leaf entry in the table at the given level.
+  static unsigned page_shift(unsigned level) { return layout::shift(level); }
+
+  static uint64_t page_mask(unsigned level) {
+    return (1ULL << page_shift(level)) - 1;
   }
 
-  static uint16_t p3_key(uint64_t vadd) {
-    //               \/- 9 bits
-    uint64_t mask = 0b111111111;
-    return (vadd & (mask << (9 + 9 + 12)) >> (9 + 9 + 12));
+  static uint64_t leaf_entry(uint64_t padd, unsigned level) {
+    return (padd & ADDR_MASK & ~page_mask(level)) | PRESENT |
+      (level > 1 ? PS : 0);
   }
 
-  static uint16_t p2_key(uint64_t vadd) {
-    //               \/- 9 bits
-    uint64_t mask = 0b111111111;
-    return (vadd & (mask << (9 + 12)) >> (9 + 12));
+  static uint64_t table_entry(Table *t) {
+    return reinterpret_cast<uint64_t>(t) | PRESENT;
   }
 
-  static uint16_t p1_key(uint64_t vadd) {
-    //               \/- 9 bits
-    uint64_t mask = 0b111111111;
-    return (vadd & (mask << 12) >> 12);
+  static Table *entry_table(uint64_t e) {
+    return reinterpret_cast<Table*>(e & ADDR_MASK);
   }
 
-  static uint16_t offset(uint64_t vadd) {
-    //               \/- 12 bits
-    uint64_t mask = 0b111111111111;
-    return vadd & mask;
+  static bool is_leaf(uint64_t e, unsigned level) {
+    return level == 1 || (e & PS);
   }
 
-  static uint64_t pb_add(uint64_t padd) {
-    //               \/- 40 bits
-    uint64_t mask = 0b1111111111111111111111111111111111111111;
-    return (padd & (mask << 12)) >> 12;
+  // An empty tree drawing its tables from pool.
+  explicit RadixTree(const std::shared_ptr<TablePool> &pool)
+    : pool_(pool), t_(NULL), s_(0), psc_entries_(0) {
+    t_ = alloc_table();
+    reset_walk_cache_counters();
+  }
+
+  Table *alloc_table() { return static_cast<Table*>(pool_->alloc()); }
+
+  static uint32_t &shares(Table *t) { return TablePool::meta(t).shares; }
+
+  // The occupancy bitmap of table t, kept in step with its present
+  // entries so that scans need not read the empty ones.
+  static uint64_t *occupied(Table *t) { return TablePool::meta(t).occupied; }
+  static void occupy(Table *t, size_t i) {
+    occupied(t)[i / 64] |= 1ULL << (i % 64);
+  }
+  static void vacate(Table *t, size_t i) {
+    occupied(t)[i / 64] &= ~(1ULL << (i % 64));
+  }
+
+  // Number of present entries in t.
+  static size_t count(Table *t) {
+    const uint64_t *bits = occupied(t);
+    size_t n = 0;
+    for(size_t w = 0; w < table_size / 64; ++w)
+      n += __builtin_popcountll(bits[w]);
+    return n;
+  }
+  static bool empty(Table *t) {
+    const uint64_t *bits = occupied(t);
+    uint64_t any = 0;
+    for(size_t w = 0; w < table_size / 64; ++w) any |= bits[w];
+    return any == 0;
+  }
+
+  // Index of the first present entry of t at or after i, or table_size
+  // if there is none.
+  static size_t next_entry(Table *t, size_t i) {
+    const uint64_t *bits = occupied(t);
+    for(size_t w = i / 64; w < table_size / 64; ++w) {
+      uint64_t m = bits[w];
+      if(w == i / 64) m &= ~0ULL << (i % 64);
+      if(m) return w * 64 + __builtin_ctzll(m);
+    }
+    return table_size;
+  }
+
+  // Number of pages mapped by the table at the given level.  A p1
+  // table maps exactly as many pages as it has entries.
+  static size_t mapped(Table *t, unsigned level) {
+    if(level == 1) return count(t);
+    size_t pages = 0;
+    for(size_t i = next_entry(t, 0); i < table_size; i = next_entry(t, i + 1)) {
+      uint64_t e = t->e[i];
+      if(is_leaf(e, level)) ++pages;
+      else pages += mapped(entry_table(e), level - 1);
+    }
+    return pages;
+  }
+
+  // Drops a reference to the table at the given level, freeing it and
+  // everything below it unless it is shared, and returns the number of
+  // pages it mapped.
+  size_t free_table(Table *t, unsigned level) {
+    if(shares(t) != 0) {
+      --shares(t);
+      return mapped(t, level);
+    }
+    size_t pages = 0;
+    if(level == 1) {
+      pages = count(t);
+      pool_->free(t);
+      return pages;
+    }
+    for(size_t i = next_entry(t, 0); i < table_size; i = next_entry(t, i + 1)) {
+      uint64_t e = t->e[i];
+      if(is_leaf(e, level)) ++pages;
+      else pages += free_table(entry_table(e), level - 1);
+    }
+    pool_->free(t);
+    return pages;
+  }
+
+  // Gives entry e its own copy of the table at the given level which
+  // it points to, if that table is shared.  The tables below the copy
+  // gain a reference.
+  Table *unshare(uint64_t &e, unsigned level) {
+    Table *old = entry_table(e);
+    if(shares(old) == 0) return old;
+    Table *t = alloc_table();
+    memcpy(t, old, sizeof(Table));
+    memcpy(occupied(t), occupied(old), table_size / 8);
+    for(size_t i = next_entry(t, 0); level > 1 && i < table_size;
+        i = next_entry(t, i + 1)) {
+      uint64_t c = t->e[i];
+      if(!is_leaf(c, level)) ++shares(entry_table(c));
+    }
+    --shares(old);
+    e = table_entry(t);
+    return t;
+  }
+
+  // Replaces the large page mapped by e at the given level with a
+  // table of 512 pages of the next size down mapping the same range.
+  Table *split(uint64_t e, unsigned level) {
+    Table *t = alloc_table();
+    uint64_t base = e & ADDR_MASK;
+    for(size_t i = 0; i < table_size; ++i)
+      t->e[i] = leaf_entry(base + (i << page_shift(level - 1)), level - 1);
+    memset(occupied(t), 0xff, table_size / 8);
+    s_ += table_size - 1;
+    return t;
+  }
+
+  // Returns the table pointed to by entry e of table t at the given
+  // level, allocating it (or splitting a large page) if necessary, and
+  // copying it if it is shared, so that it may be written.
+  Table *descend(Table *t, uint64_t &e, unsigned level) {
+    if(!(e & PRESENT)) {
+      e = table_entry(alloc_table());
+      occupy(t, &e - t->e);
+    } else if(e & PS) {
+      e = table_entry(split(e, level));
+    } else {
+      return unshare(e, level - 1);
+    }
+    return entry_table(e);
+  }
+
+  // Removes the mappings in [lo, hi) from table t at the given level,
+  // whose first entry maps base.  Entries wholly inside the range are
+  // dropped along with everything below them, and only entries
+  // straddling either end of it are descended into.  Tables which
+  // become empty are returned to the pool.
+  void erase_in(Table *t, unsigned level, uint64_t base,
+                uint64_t lo, uint64_t hi) {
+    const uint64_t span = 1ULL << page_shift(level);
+    size_t first = lo > base ? (lo - base) / span : 0;
+    size_t last = (hi - base - 1) / span;
+    if(last >= table_size) last = table_size - 1;
+    for(size_t i = next_entry(t, first); i <= last; i = next_entry(t, i + 1)) {
+      uint64_t &e = t->e[i];
+      uint64_t ebase = base + i * span;
+      if(lo <= ebase && ebase + span <= hi) {
+        if(is_leaf(e, level)) --s_;
+        else s_ -= free_table(entry_table(e), level - 1);
+      } else {
+        Table *child = descend(t, e, level);
+        erase_in(child, level - 1, ebase, lo, hi);
+        if(!empty(child)) continue;
+        pool_->free(child);
+      }
+      e = 0;
+      vacate(t, i);
+    }
+  }
+
+  // The walk-cache slot for the table at the given level on the walk
+  // to vadd, and the tag it holds if it caches that table.
+  WalkCacheEntry &psc_slot(uint64_t vadd, unsigned level, uint64_t &tag) {
+    const uint64_t va_mask = (1ULL << 48) - 1;
+    tag = ((vadd & va_mask) >> page_shift(level + 1)) | (1ULL << 63);
+    return psc_[(level - 1) * psc_entries_ + (tag & (psc_entries_ - 1))];
+  }
+
+  // Drops the tables cached on the walk to vadd.
+  void psc_invalidate(uint64_t vadd) {
+    if(psc_.empty()) return;
+    for(unsigned level = 1; level <= 3; ++level) {
+      uint64_t tag;
+      WalkCacheEntry &w = psc_slot(vadd, level, tag);
+      if(w.tag == tag) w.tag = 0;
+    }
+  }
+
+  void psc_flush() {
+    for(size_t i = 0; i < psc_.size(); ++i) psc_[i].tag = 0;
+  }
+
+  // find() through the walk cache, filling it on the way down.  The
+  // walk is unrolled, as in find(), so that the loads of independent
+  // lookups can overlap.
+  RadixTreeIterator find_cached(uint64_t vadd) {
+    ++psc_lookups_;
+    uint64_t tag1, tag2, tag3;
+    WalkCacheEntry &w1 = psc_slot(vadd, 1, tag1);
+    WalkCacheEntry &w2 = psc_slot(vadd, 2, tag2);
+    WalkCacheEntry &w3 = psc_slot(vadd, 3, tag3);
+    Table *t = t_;
+    unsigned level = 4;
+    if(w1.tag == tag1) { t = w1.t; level = 1; }
+    else if(w2.tag == tag2) { t = w2.t; level = 2; }
+    else if(w3.tag == tag3) { t = w3.t; level = 3; }
+    if(level < 4) ++psc_hits_[level - 1];
+    uint64_t e;
+    switch(level) {
+    case 4:
+      e = t->e[key<4>(vadd)];
+      if(!(e & PRESENT)) return end();
+      t = entry_table(e);
+      w3.tag = tag3;
+      w3.t = t;
+      // Fall through
+    case 3:
+      e = t->e[key<3>(vadd)];
+      if(!(e & PRESENT)) return end();
+      if(e & PS)
+        return RadixTreeIterator(vadd, (e & ADDR_MASK) | (vadd & page_mask(3)));
+      t = entry_table(e);
+      w2.tag = tag2;
+      w2.t = t;
+      // Fall through
+    case 2:
+      e = t->e[key<2>(vadd)];
+      if(!(e & PRESENT)) return end();
+      if(e & PS)
+        return RadixTreeIterator(vadd, (e & ADDR_MASK) | (vadd & page_mask(2)));
+      t = entry_table(e);
+      w1.tag = tag1;
+      w1.t = t;
+      // Fall through
+    default:
+      e = t->e[key<1>(vadd)];
+      if(!(e & PRESENT)) return end();
+      return RadixTreeIterator(vadd, (e & ADDR_MASK) | offset(vadd));
+    }
   }
 
-  static const size_t p4_size = 512;
-  static const size_t p3_size = 512;
-  static const size_t p2_size = 512;
-  static const size_t p1_size = 512;
-  
 public:
   
-  RadixTree() : t_(p4_size), s_(0) {}
-  void insert(uint64_t vadd, uint64_t padd) {
-    uint16_t p4k = p4_key(vadd);
-    uint16_t p3k = p3_key(vadd);
-    uint16_t p2k = p2_key(vadd);
-    uint16_t p1k = p1_key(vadd);
-    if(t_[p4k] == NULL)
-      t_[p4k] = new vector< vector< vector<uint64_t>* >* >(p3_size);
-    if((*t_[p4k])[p3k] == NULL)
-      (*t_[p4k])[p3k] = new vector< vector<uint64_t>* >(p2_size);
-    if((*(*t_[p4k])[p3k])[p2k] == NULL)
-      (*(*t_[p4k])[p3k])[p2k] = new vector<uint64_t>(p1_size);
-    (*(*(*t_[p4k])[p3k])[p2k])[p1k] = pb_add(padd) << 12;
+  RadixTree()
+    : pool_(std::make_shared<TablePool>()), t_(NULL), s_(0),
+      psc_entries_(0) {
+    t_ = alloc_table();
+    reset_walk_cache_counters();
+  }
+  RadixTree(const RadixTree&) = delete;
+  RadixTree& operator=(const RadixTree&) = delete;
+  // Tables shared with other trees outlive this one.
+  ~RadixTree() { if(pool_.use_count() > 1) free_table(t_, 4); }
+
+  // Returns a copy-on-write clone of the tree.  Only the p4 table is
+  // copied; every table below it is shared until either tree writes
+  // through it.
+  std::unique_ptr<RadixTree> fork() {
+    std::unique_ptr<RadixTree> child(new RadixTree(pool_));
+    memcpy(child->t_, t_, sizeof(Table));
+    memcpy(occupied(child->t_), occupied(t_), table_size / 8);
+    for(size_t i = next_entry(t_, 0); i < table_size; i = next_entry(t_, i + 1))
+      ++shares(entry_table(t_->e[i]));
+    child->s_ = s_;
+    child->set_walk_cache(psc_entries_);
+    return child;
+  }
+
+
+  // Maps the page of the given size containing vadd to the one
+  // containing padd.  Any mappings previously covering the page are
+  // replaced; a larger page containing it is first split.
+  void insert(uint64_t vadd, uint64_t padd, PageSize ps = PAGE_4K) {
+    const unsigned level = ps;
+    // A 1 GB page may free every p1 table below it, each cached under
+    // its own 2 MB of address space.
+    if(level == 3) psc_flush();
+    else psc_invalidate(vadd);
+    Table *t = descend(t_, t_->e[key<4>(vadd)], 4);
+    uint64_t *e = &t->e[key<3>(vadd)];
+    if(level < 3) { t = descend(t, *e, 3); e = &t->e[key<2>(vadd)]; }
+    if(level < 2) { t = descend(t, *e, 2); e = &t->e[key<1>(vadd)]; }
+    if(*e & PRESENT) {
+      if(is_leaf(*e, level)) --s_;
+      else s_ -= free_table(entry_table(*e), level - 1);
+    } else {
+      occupy(t, e - t->e);
+    }
+    *e = leaf_entry(padd, level);
     ++s_;
   }
+  // Maps each of n 4 KB pages, pages[i].first to pages[i].second, as
+  // insert() would.  Runs of pages in the same 2 MB region go straight
+  // into its p1 table, which is reached once per run, so pages sorted
+  // by address fill each table in one pass.
+  void insert_sorted(const std::pair<uint64_t, uint64_t> *pages, size_t n) {
+    const uint64_t va_mask = (1ULL << 48) - 1;
+    // Copying or splitting tables on the way down replaces them
+    psc_flush();
+    Table *t = NULL;
+    uint64_t region = 0;
+    for(size_t i = 0; i < n; ++i) {
+      const uint64_t vadd = pages[i].first;
+      const uint64_t r = (vadd & va_mask) >> page_shift(2);
+      if(t == NULL || r != region) {
+        t = descend(t_, t_->e[key<4>(vadd)], 4);
+        t = descend(t, t->e[key<3>(vadd)], 3);
+        t = descend(t, t->e[key<2>(vadd)], 2);
+        region = r;
+      }
+      const size_t k = key<1>(vadd);
+      if(t->e[k] & PRESENT) --s_;
+      else occupy(t, k);
+      t->e[k] = leaf_entry(pages[i].second, 1);
+      ++s_;
+    }
+  }
+  // Removes the 4 KB page containing vadd, splitting a large page
+  // containing it if need be.
+  void erase(uint64_t vadd) {
+    uint64_t lo = vadd & ~page_mask(1);
+    erase_range(lo, lo + (1ULL << page_shift(1)));
+  }
+  // Removes every mapping in [lo, hi), splitting large pages which
+  // straddle either end.  A 4 KB page only partly inside the range is
+  // removed whole.  Both ends must lie in the same (lower or upper)
+  // half of the address space.
+  void erase_range(uint64_t lo, uint64_t hi) {
+    const uint64_t va_mask = (1ULL << 48) - 1;
+    if(hi <= lo) return;
+    lo &= ~page_mask(1);
+    hi = ((hi - 1) | page_mask(1)) + 1;
+    if((lo ^ (hi - 1)) >> page_shift(2)) psc_flush();
+    else psc_invalidate(lo);
+    uint64_t lo48 = lo & va_mask;
+    erase_in(t_, 4, 0, lo48, lo48 + (hi - lo));
+  }
   RadixTreeIterator find(uint64_t vadd) {
-    uint16_t p4k = p4_key(vadd);
-    uint16_t p3k = p3_key(vadd);
-    uint16_t p2k = p2_key(vadd);
-    uint16_t p1k = p1_key(vadd);
-    if(t_[p4k] == NULL ||
-       (*t_[p4k])[p3k] == NULL ||
-       (*(*t_[p4k])[p3k])[p2k] == NULL)
-      return end();
-    uint64_t base = (pb_add((*(*(*t_[p4k])[p3k])[p2k])[p1k]));
-    uint64_t padd = offset(vadd) & (base << 12);
-    return RadixTreeIterator(vadd, padd);
+    if(!psc_.empty()) return find_cached(vadd);
+    uint64_t e = t_->e[key<4>(vadd)];
+    if(!(e & PRESENT)) return end();
+    e = entry_table(e)->e[key<3>(vadd)];
+    if(!(e & PRESENT)) return end();
+    if(e & PS)
+      return RadixTreeIterator(vadd, (e & ADDR_MASK) | (vadd & page_mask(3)));
+    e = entry_table(e)->e[key<2>(vadd)];
+    if(!(e & PRESENT)) return end();
+    if(e & PS)
+      return RadixTreeIterator(vadd, (e & ADDR_MASK) | (vadd & page_mask(2)));
+    e = entry_table(e)->e[key<1>(vadd)];
+    if(!(e & PRESENT)) return end();
+    return RadixTreeIterator(vadd, (e & ADDR_MASK) | offset(vadd));
+  }
+  // Looks up n addresses at once, storing the physical address of
+  // vadds[i] in padds[i], or -1 if it is unmapped, and returns the
+  // number found.  The addresses are walked in groups, one level at a
+  // time across the whole group, prefetching each entry a level before
+  // it is read, so that the cache misses of independent walks overlap
+  // rather than being paid one after another.
+  size_t find_batch(const uint64_t *vadds, uint64_t *padds, size_t n) {
+    static const size_t group = 16;
+    const uint64_t *ent[group];
+    size_t found = 0;
+    for(size_t base = 0; base < n; base += group) {
+      const uint64_t *v = vadds + base;
+      uint64_t *p = padds + base;
+      const size_t m = n - base < group ? n - base : group;
+      for(size_t i = 0; i < m; ++i) {
+        p[i] = -1;
+        ent[i] = &t_->e[key<4>(v[i])];
+      }
+      for(unsigned level = 4; level > 0; --level) {
+        for(size_t i = 0; i < m; ++i) {
+          if(ent[i] == NULL) continue;
+          uint64_t e = *ent[i];
+          if(!(e & PRESENT)) {
+            ent[i] = NULL;
+          } else if(is_leaf(e, level)) {
+            p[i] = (e & ADDR_MASK) | (v[i] & page_mask(level));
+            ent[i] = NULL;
+            ++found;
+          } else {
+            unsigned shift = page_shift(level - 1);
+            ent[i] = &entry_table(e)->e[(v[i] >> shift) & (table_size - 1)];
+            __builtin_prefetch(ent[i]);
+          }
+        }
+      }
+    }
+    return found;
   }
   RadixTreeIterator end() { return RadixTreeIterator(-1, -1, true); }
-  void clear() {
-    for(size_t p4i = 0; p4i < p4_size; ++p4i) {
-      vector< vector< vector<uint64_t>* >* >* p3 = t_[p4i];
-      if(p3 == NULL) continue;
-      for(size_t p3i = 0; p3i < p3_size; ++p3i) {
-        vector< vector<uint64_t>* >* p2 = (*p3)[p3i];
-        if(p2 == NULL) continue;
-        for(size_t p2i = 0; p2i < p2_size; ++p2i) {
-          vector<uint64_t>* p1 = (*p2)[p2i];
-          if(p1 == NULL) continue;
-          p1->clear();
-          delete p1;
+
+  // Visits the mappings of a tree in address order, pages of every
+  // size alike, skipping empty entries by their tables' bitmaps.  Any
+  // change to the tree invalidates it.
+  class iterator {
+    friend class RadixTree;
+    Table *t_[5];      // The table at each level of the path; t_[4] is p4
+    size_t i_[5];      // The entry followed in each
+    unsigned level_;   // Level of the current leaf entry, 0 at the end
+
+    // Moves to the first leaf at or after entry start of the table at
+    // the given level.  While exact, the path so far is that of vadd,
+    // and the walk below starts at vadd's entry rather than the first.
+    void seek(unsigned level, size_t start, uint64_t vadd, bool exact) {
+      for(;;) {
+        size_t j = next_entry(t_[level], start);
+        if(j == table_size) {
+          if(level == 4) { level_ = 0; return; }
+          ++level;
+          start = i_[level] + 1;
+          exact = false;
+          continue;
         }
-        p2->clear();
-        delete p2;
+        exact = exact && j == start;
+        i_[level] = j;
+        uint64_t e = t_[level]->e[j];
+        if(is_leaf(e, level)) { level_ = level; return; }
+        t_[level - 1] = entry_table(e);
+        --level;
+        start = exact ? (vadd >> page_shift(level)) & (table_size - 1) : 0;
       }
-      p3->clear();
-      delete p3;
-      t_[p4i] = NULL;
     }
-    t_.clear();
+
+  public:
+    iterator() : level_(0) {}
+
+    bool isValid() const { return level_ != 0; }
+    // The first address of the current page, sign-extended, or -1 at
+    // the end, as for an invalid RadixTreeIterator.
+    uint64_t vadd() const {
+      if(level_ == 0) return -1;
+      uint64_t v = 0;
+      for(unsigned l = 4; l >= level_; --l)
+        v |= uint64_t(i_[l]) << page_shift(l);
+      if(v & (1ULL << 47)) v |= ~((1ULL << 48) - 1);
+      return v;
+    }
+    // The physical address the current page maps to.
+    uint64_t operator*() const { return t_[level_]->e[i_[level_]] & ADDR_MASK; }
+    PageSize page_size() const { return PageSize(level_); }
+    iterator &operator++() {
+      seek(level_, i_[level_] + 1, 0, false);
+      return *this;
+    }
+  };
+
+  iterator begin() { return lower_bound(0); }
+  // The first mapping whose page contains or follows vadd.
+  iterator lower_bound(uint64_t vadd) {
+    iterator it;
+    it.t_[4] = t_;
+    it.seek(4, key<4>(vadd), vadd, true);
+    return it;
+  }
+  // Calls f(vadd, padd) with the first virtual and physical address of
+  // every page overlapping [lo, hi), in order, and returns their number.
+  template<class F>
+  size_t for_each_in_range(uint64_t lo, uint64_t hi, F f) {
+    size_t n = 0;
+    for(iterator it = lower_bound(lo); it.isValid(); ++it, ++n) {
+      uint64_t v = it.vadd();
+      if(v >= hi) break;
+      f(v, *it);
+    }
+    return n;
+  }
+  // Every table, including the p4 table, comes from the pool, so
+  // clearing a tree which shares it with no forks is a bulk reset of
+  // the pool.
+  void clear() {
+    if(pool_.use_count() == 1) pool_->reset();
+    else free_table(t_, 4);
+    t_ = alloc_table();
     s_ = 0;
+    psc_flush();
   }
   size_t size() { return s_; }
+  // Number of 4 KB tables currently allocated, including the p4 table,
+  // by this tree and any it shares its pool with.
+  size_t tables() { return pool_->live(); }
+  // Number of 2 MB slabs the tables are carved from.
+  size_t slabs() { return pool_->slabs(); }
+  // Bytes of memory held by the tree, including its table pool.
+  size_t memory_bytes() {
+    return sizeof(*this) + pool_->bytes() +
+      psc_.capacity() * sizeof(WalkCacheEntry);
+  }
+
+  // Caches the p3, p2 and p1 tables of recent walks in the given number
+  // of slots per level, rounded up to a power of two, or stops caching
+  // them if 0.
+  void set_walk_cache(size_t entries) {
+    while(entries & (entries - 1)) entries += entries & -entries;
+    psc_entries_ = entries;
+    psc_.assign(3 * entries, WalkCacheEntry());
+  }
+  // Number of find() calls through the walk cache, and of those which
+  // started at the cached table of the given level (1 to 3).
+  size_t walk_cache_lookups() { return psc_lookups_; }
+  size_t walk_cache_hits(unsigned level) { return psc_hits_[level - 1]; }
+  void reset_walk_cache_counters() {
+    psc_lookups_ = 0;
+    psc_hits_[0] = psc_hits_[1] = psc_hits_[2] = 0;
+  }
 };
 
 // Given a 64-bit number vadd, returns the same number but with the
@@ -3,12 +3,105 @@
 #include <bitset>
 #include <random>
 #include <cstdint>
+#include <memory>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
 #include "radixtree.hpp"
+#include "radix_image.hpp"
+#include "nested.hpp"
+#include "concurrent_radixtree.hpp"
+#include "hashed_pagetable.hpp"
+#include "swiss_table.hpp"
+#include "bplustree.hpp"
+#include "mapletree.hpp"
 
 
 const size_t small_test_size = 5;
 const size_t big_test_size = 1000;
 
+// Checks a BPlusTree against a map through random inserts and erases
+// over a few thousand keys, growing it to several levels and erasing
+// it back to a single leaf.  Returns false on the first mismatch.
+template<unsigned Fanout>
+bool test_bplustree(std::mt19937 &generator) {
+  BPlusTree<Fanout> bpt;
+  std::map<uint64_t, uint64_t> ref;
+  std::uniform_int_distribution<uint64_t> keys(0, 4000), coin(0, 99);
+  for(int phase = 0; phase < 3; ++phase) {
+    // Mostly inserts, then even, then mostly erases
+    const uint64_t inserts = phase == 0 ? 80 : phase == 1 ? 50 : 20;
+    for(uint32_t i = 0; i < 20000; ++i) {
+      uint64_t k = keys(generator) * 4096;
+      if(coin(generator) < inserts) {
+        bpt.insert(k, k + 1);
+        ref[k] = k + 1;
+      } else if(bpt.erase(k) != (ref.erase(k) != 0)) {
+        std::cout << "B+ TREE ERASE FAILED" << std::endl;
+        return false;
+      }
+      // Lookups at, just below and just above a key
+      uint64_t q = keys(generator) * 4096 + coin(generator) % 3 - 1;
+      typename BPlusTree<Fanout>::iterator it = bpt.find(q);
+      std::map<uint64_t, uint64_t>::iterator r = ref.find(q);
+      if((it == bpt.end()) != (r == ref.end()) ||
+         (r != ref.end() && (it.key() != q || *it != r->second))) {
+        std::cout << "B+ TREE FIND FAILED" << std::endl;
+        return false;
+      }
+      it = bpt.lower_bound(q);
+      r = ref.lower_bound(q);
+      if((it == bpt.end()) != (r == ref.end()) ||
+         (r != ref.end() && it.key() != r->first)) {
+        std::cout << "B+ TREE LOWER_BOUND FAILED" << std::endl;
+        return false;
+      }
+      it = bpt.floor(q);
+      r = ref.upper_bound(q);
+      if((it == bpt.end()) != (r == ref.begin()) ||
+         (r != ref.begin() && it.key() != (--r)->first)) {
+        std::cout << "B+ TREE FLOOR FAILED" << std::endl;
+        return false;
+      }
+      if(bpt.size() != ref.size()) {
+        std::cout << "B+ TREE SIZE WRONG" << std::endl;
+        return false;
+      }
+    }
+    std::cout << "  FANOUT: " << Fanout << " SIZE(): " << bpt.size()
+              << " HEIGHT(): " << bpt.height() << std::endl;
+    std::map<uint64_t, uint64_t>::iterator r = ref.begin();
+    for(typename BPlusTree<Fanout>::iterator it = bpt.begin();
+        it != bpt.end(); ++it, ++r) {
+      if(r == ref.end() || it.key() != r->first || *it != r->second) {
+        std::cout << "B+ TREE ITERATION OUT OF ORDER" << std::endl;
+        return false;
+      }
+    }
+    if(r != ref.end()) {
+      std::cout << "B+ TREE ITERATION ENDED EARLY" << std::endl;
+      return false;
+    }
+  }
+  // Erasing the rest collapses the tree to a single empty leaf.
+  for(std::map<uint64_t, uint64_t>::iterator r = ref.begin();
+      r != ref.end(); ++r) {
+    if(!bpt.erase(r->first)) {
+      std::cout << "B+ TREE ERASE FAILED" << std::endl;
+      return false;
+    }
+  }
+  if(bpt.size() != 0 || bpt.height() != 1 || bpt.nodes() != 1 ||
+     bpt.begin() != bpt.end() || bpt.floor(~0ULL) != bpt.end()) {
+    std::cout << "B+ TREE DID NOT COLLAPSE" << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main() {
   std::cout << "========== RADIX TREE ==========" << std::endl;
   std::random_device device;
@@ -32,6 +125,9 @@ int main() {
       if(!rti.isValid()) {
         std::cout << "FIND RETURNED INVALID RESULT" << std::endl;
         return -1;
+      } else if(*rti != padd) {
+        std::cout << "FIND RETURNED WRONG ADDRESS " << *rti << std::endl;
+        return -1;
       } else {
         std::cout << "  FIND(" << vadd << "," << padd << ")" << std::endl;
       }
@@ -44,18 +140,733 @@ int main() {
   {
     std::cout << "========== BIG TEST ==========" << std::endl;
     RadixTree rt;
+    std::vector<uint64_t> vadds, padds;
     for(uint32_t i = 0; i < big_test_size; ++i) {
       uint64_t vadd = correctify_vadd(dist(generator));
       uint64_t padd = correctify_padd(vadd, dist(generator));
       rt.insert(vadd, padd);
       RadixTreeIterator rti = rt.find(vadd);
-      if(!rti.isValid()) {
+      if(!rti.isValid() || *rti != padd) {
         std::cout << "FIND RETURNED INVALID RESULT" << std::endl;
         return -1;
       }
+      vadds.push_back(vadd);
+      padds.push_back(padd);
+    }
+    // Every other address is turned into an unmapped one.
+    for(uint32_t i = 0; i < big_test_size; i += 2) {
+      vadds[i] ^= 1ULL << 46;
+      padds[i] = -1;
+    }
+    std::vector<uint64_t> batch(big_test_size);
+    size_t found = rt.find_batch(&vadds[0], &batch[0], big_test_size);
+    if(found != big_test_size / 2 || batch != padds) {
+      std::cout << "FIND_BATCH RETURNED INVALID RESULT" << std::endl;
+      return -1;
     }
     rt.clear();
   }
-  
+  {
+    std::cout << "========== HUGE PAGE TEST ==========" << std::endl;
+    RadixTree rt;
+    const uint64_t gig = 1ULL << 30, meg2 = 1ULL << 21, page = 1ULL << 12;
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    rt.insert(vbase, pbase, RadixTree::PAGE_1G);
+    rt.insert(vbase + gig, pbase + gig, RadixTree::PAGE_2M);
+    std::cout << "  SIZE(): " << rt.size()
+              << " TABLES(): " << rt.tables() << std::endl;
+    if(rt.size() != 2 || rt.tables() != 3 ||
+       *rt.find(vbase + 12345678) != pbase + 12345678 ||
+       *rt.find(vbase + gig + 4321) != pbase + gig + 4321 ||
+       rt.find(vbase + gig + meg2).isValid()) {
+      std::cout << "LARGE PAGE LOOKUP FAILED" << std::endl;
+      return -1;
+    }
+    // A 4 KB page inside the 1 GB page splits it twice, and the
+    // remainder of the large page stays mapped around it.
+    rt.insert(vbase + 3 * page, 0x1234000);
+    std::cout << "  SIZE(): " << rt.size()
+              << " TABLES(): " << rt.tables() << std::endl;
+    if(rt.size() != 2 + 511 + 511 || rt.tables() != 5 ||
+       *rt.find(vbase + 3 * page + 7) != 0x1234007 ||
+       *rt.find(vbase + 2 * page + 7) != pbase + 2 * page + 7 ||
+       *rt.find(vbase + meg2 + 9) != pbase + meg2 + 9) {
+      std::cout << "SPLIT LARGE PAGE LOOKUP FAILED" << std::endl;
+      return -1;
+    }
+    // Mapping a large page over small ones frees the tables below it.
+    rt.insert(vbase, pbase, RadixTree::PAGE_1G);
+    if(rt.size() != 2 || rt.tables() != 3) {
+      std::cout << "LARGE PAGE REPLACE FAILED" << std::endl;
+      return -1;
+    }
+    rt.clear();
+    std::cout << "  SIZE(): " << rt.size()
+              << " TABLES(): " << rt.tables() << std::endl;
+  }
+  {
+    std::cout << "========== ERASE TEST ==========" << std::endl;
+    RadixTree rt;
+    std::vector<uint64_t> vadds;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator));
+      rt.insert(vadd, correctify_padd(vadd, dist(generator)));
+      vadds.push_back(vadd);
+    }
+    // Erasing every mapping one at a time frees every table.
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      rt.erase(vadds[i]);
+      if(rt.find(vadds[i]).isValid()) {
+        std::cout << "ERASED MAPPING STILL FOUND" << std::endl;
+        return -1;
+      }
+    }
+    std::cout << "  SIZE(): " << rt.size()
+              << " TABLES(): " << rt.tables() << std::endl;
+    if(rt.size() != 0 || rt.tables() != 1) {
+      std::cout << "ERASE DID NOT RECLAIM TABLES" << std::endl;
+      return -1;
+    }
+    // A range covering whole tables, and the ends of a large page.
+    const uint64_t meg2 = 1ULL << 21, page = 1ULL << 12;
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    for(uint64_t i = 0; i < 4 * 512; ++i) {
+      rt.insert(vbase + i * page, pbase + i * page);
+    }
+    rt.insert(vbase + 4 * meg2, pbase, RadixTree::PAGE_2M);
+    rt.erase_range(vbase + page, vbase + 4 * meg2 + page);
+    std::cout << "  SIZE(): " << rt.size()
+              << " TABLES(): " << rt.tables() << std::endl;
+    if(rt.size() != 1 + 511 || rt.tables() != 5 ||
+       *rt.find(vbase) != pbase ||
+       rt.find(vbase + meg2).isValid() ||
+       rt.find(vbase + 4 * meg2).isValid() ||
+       *rt.find(vbase + 4 * meg2 + page) != pbase + page) {
+      std::cout << "ERASE_RANGE FAILED" << std::endl;
+      return -1;
+    }
+    // Unaligned ends take the whole 4 KB pages they fall in.
+    rt.insert(vbase + page, pbase + page);
+    rt.insert(vbase + 2 * page, pbase + 2 * page);
+    rt.insert(vbase + 3 * page, pbase + 3 * page);
+    rt.erase_range(vbase + page + 0x800, vbase + 2 * page + 1);
+    if(rt.size() != 1 + 511 + 1 ||
+       rt.find(vbase + page).isValid() ||
+       rt.find(vbase + 2 * page).isValid() ||
+       *rt.find(vbase + 3 * page) != pbase + 3 * page) {
+      std::cout << "UNALIGNED ERASE_RANGE FAILED" << std::endl;
+      return -1;
+    }
+    rt.erase_range(vbase, vbase + 8 * meg2);
+    if(rt.size() != 0 || rt.tables() != 1) {
+      std::cout << "ERASE_RANGE DID NOT RECLAIM TABLES" << std::endl;
+      return -1;
+    }
+  }
+  {
+    std::cout << "========== FORK TEST ==========" << std::endl;
+    RadixTree parent;
+    std::vector<uint64_t> vadds, padds;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator));
+      uint64_t padd = correctify_padd(vadd, dist(generator));
+      parent.insert(vadd, padd);
+      vadds.push_back(vadd);
+      padds.push_back(padd);
+    }
+    const size_t tables = parent.tables();
+    std::unique_ptr<RadixTree> child = parent.fork();
+    // Only the p4 table is copied.
+    if(child->size() != parent.size() || parent.tables() != tables + 1) {
+      std::cout << "FORK COPIED TABLES" << std::endl;
+      return -1;
+    }
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      if(*child->find(vadds[i]) != padds[i]) {
+        std::cout << "FORKED LOOKUP FAILED" << std::endl;
+        return -1;
+      }
+    }
+    // A write copies the p3, p2 and p1 tables above it, in one tree
+    // only.
+    child->insert(vadds[0], padds[1]);
+    if(parent.tables() != tables + 4 ||
+       *child->find(vadds[0]) != (padds[1] & ~0xfffULL) + (vadds[0] & 0xfff) ||
+       *parent.find(vadds[0]) != padds[0]) {
+      std::cout << "COPY ON WRITE FAILED" << std::endl;
+      return -1;
+    }
+    // Erasing from the parent leaves the child's mappings alone.
+    for(uint32_t i = 1; i < big_test_size; ++i) parent.erase(vadds[i]);
+    for(uint32_t i = 1; i < big_test_size; ++i) {
+      if(*child->find(vadds[i]) != padds[i]) {
+        std::cout << "ERASE AFTER FORK FAILED" << std::endl;
+        return -1;
+      }
+    }
+    // A fork of a fork, then both forks dropped.
+    std::unique_ptr<RadixTree> grandchild = child->fork();
+    grandchild->erase_range(0, 1ULL << 47);
+    child.reset();
+    grandchild.reset();
+    std::cout << "  SIZE(): " << parent.size()
+              << " TABLES(): " << parent.tables() << std::endl;
+    if(parent.size() != 1 || *parent.find(vadds[0]) != padds[0] ||
+       parent.tables() != 4) {
+      std::cout << "FORKED TABLES NOT RECLAIMED" << std::endl;
+      return -1;
+    }
+  }
+  {
+    std::cout << "========== IMAGE TEST ==========" << std::endl;
+    RadixTree rt;
+    std::vector<uint64_t> vadds, padds;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator));
+      uint64_t padd = correctify_padd(vadd, dist(generator));
+      rt.insert(vadd, padd);
+      vadds.push_back(vadd);
+      padds.push_back(padd);
+    }
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    rt.insert(vbase, pbase, RadixTree::PAGE_1G);
+    rt.insert(vbase + (1ULL << 30), pbase, RadixTree::PAGE_2M);
+    char path[] = "/tmp/radixtree_test_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+      std::cout << "CANNOT CREATE IMAGE FILE" << std::endl;
+      return -1;
+    }
+    close(fd);
+    RadixTreeImage::write(rt, path);
+    {
+      RadixTreeImage image(path);
+      std::cout << "  SIZE(): " << image.size()
+                << " TABLES(): " << image.tables() << std::endl;
+      if(image.size() != rt.size() || image.tables() != rt.tables()) {
+        std::cout << "IMAGE SIZE WRONG" << std::endl;
+        return -1;
+      }
+      for(uint32_t i = 0; i < big_test_size; ++i) {
+        uint64_t other = vadds[i] ^ (1ULL << 40);
+        if(*image.find(vadds[i]) != *rt.find(vadds[i]) ||
+           image.find(other) != rt.find(other)) {
+          std::cout << "IMAGE LOOKUP FAILED" << std::endl;
+          return -1;
+        }
+      }
+      if(*image.find(vbase + 12345) != pbase + 12345 ||
+         *image.find(vbase + (1ULL << 30) + 7) != pbase + 7 ||
+         image.find(vbase + (1ULL << 30) + (1ULL << 21)).isValid()) {
+        std::cout << "IMAGE LARGE PAGE LOOKUP FAILED" << std::endl;
+        return -1;
+      }
+    }
+    unlink(path);
+  }
+
+  {
+    std::cout << "========== NESTED TEST ==========" << std::endl;
+    // Guest physical pages well away from the heap, each mapped by the
+    // host to the page the test chose.
+    const uint64_t gpaBase = 1ULL << 40;
+    RadixTree guest, host;
+    std::vector<uint64_t> vadds, padds;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator));
+      uint64_t padd = correctify_padd(vadd, dist(generator));
+      uint64_t gpa = gpaBase + (uint64_t(i) << 12);
+      if(guest.find(vadd).isValid()) continue;
+      guest.insert(vadd, gpa | (vadd & 0xfff));
+      host.insert(gpa, padd);
+      vadds.push_back(vadd);
+      padds.push_back(padd);
+    }
+    NestedWalk plain(guest, host), cached(guest, host, 64, 8);
+    plain.map_guest_tables();
+    for(int pass = 0; pass < 2; ++pass) {
+      for(size_t i = 0; i < vadds.size(); ++i) {
+        uint64_t other = vadds[i] ^ (1ULL << 40);
+        if(plain.translate(vadds[i]) != padds[i] ||
+           cached.translate(vadds[i]) != padds[i] ||
+           plain.translate(other) != uint64_t(-1) ||
+           cached.translate(other) != uint64_t(-1)) {
+          std::cout << "NESTED TRANSLATION FAILED" << std::endl;
+          return -1;
+        }
+      }
+    }
+    std::cout << "  REFERENCES(): " << plain.references()
+              << " CACHED: " << cached.references() << std::endl;
+    if(plain.counters().faults != 2 * vadds.size() ||
+       cached.references() >= plain.references()) {
+      std::cout << "NESTED COUNTERS WRONG" << std::endl;
+      return -1;
+    }
+  }
+
+  {
+    std::cout << "========== WALK CACHE TEST ==========" << std::endl;
+    // The same writes to trees with and without the cache, with lookups
+    // in between, including large pages replacing cached tables.
+    RadixTree plain, cached;
+    cached.set_walk_cache(16);
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    std::vector<uint64_t> vadds;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = vbase + (dist(generator) & ((1ULL << 34) - 1));
+      uint64_t padd = pbase + (dist(generator) & ((1ULL << 34) - 1));
+      RadixTree::PageSize ps = i % 97 == 0 ? RadixTree::PAGE_2M :
+        i % 89 == 0 ? RadixTree::PAGE_1G : RadixTree::PAGE_4K;
+      vadds.push_back(vadd);
+      if(i % 5 == 4) {
+        uint64_t victim = vadds[dist(generator) % vadds.size()];
+        plain.erase(victim);
+        cached.erase(victim);
+      } else {
+        plain.insert(vadd, padd, ps);
+        cached.insert(vadd, padd, ps);
+      }
+      if(i % 211 == 0) {
+        uint64_t lo = vadd & ~0xfffULL;
+        plain.erase_range(lo, lo + (1ULL << 30));
+        cached.erase_range(lo, lo + (1ULL << 30));
+      }
+      for(int j = 0; j < 4; ++j) {
+        uint64_t v = vadds[dist(generator) % vadds.size()] + j * 4096;
+        if(plain.find(v) != cached.find(v)) {
+          std::cout << "WALK CACHE LOOKUP FAILED" << std::endl;
+          return -1;
+        }
+      }
+    }
+    std::cout << "  LOOKUPS: " << cached.walk_cache_lookups()
+              << " HITS P1: " << cached.walk_cache_hits(1)
+              << " P2: " << cached.walk_cache_hits(2)
+              << " P3: " << cached.walk_cache_hits(3) << std::endl;
+    if(cached.walk_cache_lookups() != 4 * big_test_size ||
+       cached.walk_cache_hits(3) == 0) {
+      std::cout << "WALK CACHE COUNTERS WRONG" << std::endl;
+      return -1;
+    }
+  }
+
+  {
+    std::cout << "========== ITERATION TEST ==========" << std::endl;
+    // Pages of all sizes in both halves of the address space, visited
+    // in order against a map of their first addresses.
+    RadixTree rt;
+    std::map<uint64_t, uint64_t> pages;
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    rt.insert(vbase, pbase, RadixTree::PAGE_1G);
+    pages[vbase] = pbase;
+    rt.insert(vbase + (1ULL << 30), pbase, RadixTree::PAGE_2M);
+    pages[vbase + (1ULL << 30)] = pbase;
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = correctify_vadd(dist(generator)) & ~0xfffULL;
+      uint64_t padd = correctify_padd(vadd, dist(generator)) & ~0xfffULL;
+      if(rt.find(vadd).isValid()) continue;
+      rt.insert(vadd, padd);
+      pages[vadd] = padd;
+    }
+    std::map<uint64_t, uint64_t>::iterator p = pages.begin();
+    for(RadixTree::iterator it = rt.begin(); it.isValid(); ++it, ++p) {
+      if(p == pages.end() || it.vadd() != p->first || *it != p->second) {
+        std::cout << "ITERATION OUT OF ORDER" << std::endl;
+        return -1;
+      }
+    }
+    if(p != pages.end()) {
+      std::cout << "ITERATION ENDED EARLY" << std::endl;
+      return -1;
+    }
+    // The page itself, then from the end of the page, the next one
+    for(p = pages.begin(); p != pages.end(); ++p) {
+      RadixTree::iterator it = rt.lower_bound(p->first);
+      uint64_t end = p->first + (1ULL << (12 + 9 * (it.page_size() - 1)));
+      std::map<uint64_t, uint64_t>::iterator q = p;
+      ++q;
+      RadixTree::iterator next = rt.lower_bound(end);
+      if(!it.isValid() || it.vadd() != p->first ||
+         next.isValid() != (q != pages.end()) ||
+         (next.isValid() && next.vadd() != q->first)) {
+        std::cout << "LOWER_BOUND FAILED" << std::endl;
+        return -1;
+      }
+    }
+    if(rt.lower_bound(vbase + 12345).vadd() != vbase ||
+       rt.lower_bound(~0ULL).isValid() ||
+       rt.lower_bound(~0ULL).vadd() != ~0ULL) {
+      std::cout << "LOWER_BOUND FAILED" << std::endl;
+      return -1;
+    }
+    const uint64_t lo = 1ULL << 46, hi = 1ULL << 47;
+    size_t inRange = 0;
+    for(p = pages.lower_bound(lo); p != pages.end() && p->first < hi; ++p)
+      ++inRange;
+    size_t visited = rt.for_each_in_range(lo, hi, [&](uint64_t v, uint64_t) {
+        if(v < lo || v >= hi) inRange = 0;
+      });
+    std::cout << "  PAGES: " << pages.size() << " IN RANGE: " << visited
+              << std::endl;
+    if(visited != inRange) {
+      std::cout << "FOR_EACH_IN_RANGE FAILED" << std::endl;
+      return -1;
+    }
+  }
+
+  {
+    std::cout << "========== BULK INSERT TEST ==========" << std::endl;
+    // Sorted pages, some repeated and some in a large page, against the
+    // same pages inserted one at a time.
+    RadixTree one, bulk;
+    std::vector<std::pair<uint64_t, uint64_t> > pages;
+    const uint64_t vbase = 0x7f0000000000;
+    one.insert(vbase, 0x4000000000, RadixTree::PAGE_2M);
+    bulk.insert(vbase, 0x4000000000, RadixTree::PAGE_2M);
+    for(uint32_t i = 0; i < big_test_size; ++i) {
+      uint64_t vadd = vbase + (dist(generator) % 4096) * 4096;
+      pages.push_back(std::make_pair(vadd, correctify_padd(vadd,
+                                                           dist(generator))));
+    }
+    std::stable_sort(pages.begin(), pages.end(),
+                     [](const std::pair<uint64_t, uint64_t> &a,
+                        const std::pair<uint64_t, uint64_t> &b) {
+                       return a.first < b.first;
+                     });
+    for(size_t i = 0; i < pages.size(); ++i)
+      one.insert(pages[i].first, pages[i].second);
+    bulk.insert_sorted(&pages[0], pages.size());
+    std::cout << "  SIZE(): " << bulk.size() << " TABLES(): "
+              << bulk.tables() << std::endl;
+    if(bulk.size() != one.size() || bulk.tables() != one.tables()) {
+      std::cout << "BULK INSERT SIZE WRONG" << std::endl;
+      return -1;
+    }
+    for(uint64_t v = vbase; v < vbase + 4096 * 4096; v += 4096) {
+      if(bulk.find(v) != one.find(v)) {
+        std::cout << "BULK INSERT LOOKUP FAILED" << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  {
+    std::cout << "========== CONCURRENT TEST ==========" << std::endl;
+    // Writers insert and then erase half of their own pages, spread over
+    // their own tables, and of pages shared by all of them, while
+    // readers check pages which are never erased.
+    ConcurrentRadixTree crt;
+    const size_t writers = 4, readers = 4, per = big_test_size;
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    auto own = [&](size_t w, size_t i) {
+      return vbase + (uint64_t(w) << 32) + i * 7 * 4096;
+    };
+    auto shared = [&](size_t i) { return vbase + (1ULL << 36) + i * 4096; };
+    auto padd = [&](uint64_t v) { return pbase + (v - vbase); };
+    std::atomic<bool> done(false);
+    std::atomic<size_t> wrong(0), sharedErased(0);
+    std::vector<std::thread> threads;
+    for(size_t w = 0; w < writers; ++w) {
+      crt.insert(own(w, 0), padd(own(w, 0)));
+    }
+    for(size_t r = 0; r < readers; ++r) {
+      threads.push_back(std::thread([&, r]() {
+        for(size_t i = 0; !done.load(); i += 2) {
+          uint64_t v = own((r + i) % writers, 0);
+          RadixTreeIterator it = crt.find(v);
+          if(!it.isValid() || *it != padd(v)) ++wrong;
+          v = own((r + i) % writers, i % per);
+          it = crt.find(v);
+          if(it.isValid() && *it != padd(v)) ++wrong;
+        }
+      }));
+    }
+    std::vector<std::thread> phase;
+    for(size_t w = 0; w < writers; ++w) {
+      phase.push_back(std::thread([&, w]() {
+        for(size_t i = 0; i < per; ++i) {
+          crt.insert(own(w, i), padd(own(w, i)));
+          crt.insert(shared(i), padd(shared(i)));
+        }
+      }));
+    }
+    for(size_t w = 0; w < writers; ++w) phase[w].join();
+    phase.clear();
+    std::cout << "  SIZE(): " << crt.size() << " TABLES(): " << crt.tables()
+              << std::endl;
+    if(crt.size() != (writers + 1) * per) {
+      std::cout << "CONCURRENT INSERT SIZE WRONG" << std::endl;
+      return -1;
+    }
+    for(size_t w = 0; w < writers; ++w) {
+      phase.push_back(std::thread([&, w]() {
+        for(size_t i = 1; i < per; i += 2) crt.erase(own(w, i));
+        for(size_t i = 1; i < per; i += 2)
+          if(crt.erase(shared(i))) ++sharedErased;
+      }));
+    }
+    for(size_t w = 0; w < writers; ++w) phase[w].join();
+    phase.clear();
+    std::set<uint64_t> left;
+    for(size_t i = 0; i < per; i += 2) {
+      left.insert(shared(i));
+      for(size_t w = 0; w < writers; ++w) left.insert(own(w, i));
+    }
+    std::cout << "  SIZE(): " << crt.size() << " TABLES(): " << crt.tables()
+              << std::endl;
+    if(crt.size() != left.size() || sharedErased != per / 2) {
+      std::cout << "CONCURRENT ERASE SIZE WRONG" << std::endl;
+      return -1;
+    }
+    for(size_t i = 0; i < per; ++i) {
+      uint64_t vs[writers + 1];
+      for(size_t w = 0; w < writers; ++w) vs[w] = own(w, i);
+      vs[writers] = shared(i);
+      for(size_t k = 0; k <= writers; ++k) {
+        RadixTreeIterator it = crt.find(vs[k]);
+        if(it.isValid() != (left.count(vs[k]) != 0) ||
+           (it.isValid() && *it != padd(vs[k]))) {
+          std::cout << "CONCURRENT LOOKUP FAILED" << std::endl;
+          return -1;
+        }
+      }
+    }
+    // Everything but the pages the readers check, and then those, so
+    // that every table but the root empties.
+    for(size_t w = 0; w < writers; ++w) {
+      phase.push_back(std::thread([&, w]() {
+        for(size_t i = 2; i < per; i += 2) {
+          crt.erase(own(w, i));
+          crt.erase(shared(i));
+        }
+      }));
+    }
+    for(size_t w = 0; w < writers; ++w) phase[w].join();
+    done = true;
+    for(size_t r = 0; r < readers; ++r) threads[r].join();
+    crt.erase(shared(0));
+    for(size_t w = 0; w < writers; ++w) crt.erase(own(w, 0));
+    crt.collect();
+    std::cout << "  SIZE(): " << crt.size() << " TABLES(): " << crt.tables()
+              << " RETIRED(): " << crt.retired() << std::endl;
+    if(wrong != 0) {
+      std::cout << "CONCURRENT READER SAW WRONG MAPPING" << std::endl;
+      return -1;
+    }
+    if(crt.size() != 0 || crt.tables() != 1 || crt.retired() != 0) {
+      std::cout << "CONCURRENT TABLES NOT RECLAIMED" << std::endl;
+      return -1;
+    }
+  }
+
+  {
+    std::cout << "========== HASHED PAGE TABLE TEST ==========" << std::endl;
+    // Pages which all hash to group 0 of the initial eight fill it and
+    // its secondary, group 7, so the seventeenth must grow the table.
+    HashedPageTable hpt;
+    const uint64_t pbase = 0x4000000000;
+    std::vector<uint64_t> vpns;
+    for(uint64_t v = 1; vpns.size() < 17; ++v) {
+      if(((v * 0x9e3779b97f4a7c15ULL) >> 32) % 8 == 0) vpns.push_back(v);
+    }
+    for(size_t i = 0; i < vpns.size(); ++i) {
+      if(i == 16 && hpt.groups() != 8) {
+        std::cout << "HASHED PAGE TABLE GREW EARLY" << std::endl;
+        return -1;
+      }
+      hpt.insert(vpns[i] << 12, pbase + (i << 12));
+    }
+    // Overwrite every other page, and erase every third.
+    for(size_t i = 0; i < vpns.size(); i += 2)
+      hpt.insert(vpns[i] << 12 | 0x123, pbase + ((i + 100) << 12));
+    for(size_t i = 0; i < vpns.size(); i += 3) {
+      if(!hpt.erase(vpns[i] << 12) || hpt.erase(vpns[i] << 12)) {
+        std::cout << "HASHED PAGE TABLE ERASE FAILED" << std::endl;
+        return -1;
+      }
+    }
+    std::cout << "  SIZE(): " << hpt.size() << " GROUPS(): " << hpt.groups()
+              << std::endl;
+    if(hpt.groups() == 8 || hpt.size() != vpns.size() - 6) {
+      std::cout << "HASHED PAGE TABLE DID NOT GROW" << std::endl;
+      return -1;
+    }
+    for(size_t i = 0; i < vpns.size(); ++i) {
+      RadixTreeIterator it = hpt.find(vpns[i] << 12 | 0xabc);
+      uint64_t padd = (pbase + ((i % 2 == 0 ? i + 100 : i) << 12)) | 0xabc;
+      if(it.isValid() != (i % 3 != 0) || (it.isValid() && *it != padd)) {
+        std::cout << "HASHED PAGE TABLE LOOKUP FAILED" << std::endl;
+        return -1;
+      }
+    }
+    hpt.clear();
+    if(hpt.size() != 0 || hpt.groups() != 8 ||
+       hpt.find(vpns[1] << 12).isValid()) {
+      std::cout << "HASHED PAGE TABLE CLEAR FAILED" << std::endl;
+      return -1;
+    }
+  }
+
+  {
+    std::cout << "========== SWISS TABLE TEST ==========" << std::endl;
+    // Inserts, overwrites and erases over a few thousand pages, so that
+    // the table grows from one group, fills with tombstones and is
+    // rehashed in place, checked against a map, with and without
+    // reserve(), and again after clear().
+    const uint64_t vbase = 0x7f0000000000;
+    for(size_t reserved = 0; reserved <= 1024; reserved += 1024) {
+      SwissTable st;
+      if(reserved) st.reserve(reserved);
+      std::map<uint64_t, uint64_t> ref;
+      for(int pass = 0; pass < 2; ++pass) {
+        for(uint32_t i = 0; i < 20 * big_test_size; ++i) {
+          uint64_t vadd = vbase + (dist(generator) % 3000) * 4096;
+          uint64_t padd = correctify_padd(vadd, dist(generator)) & ~0xfffULL;
+          // Mostly inserts while small, then as many erases as inserts
+          if(dist(generator) % 4 < (ref.size() < 1000 ? 3u : 2u)) {
+            st.insert(vadd, padd);
+            ref[vadd] = padd;
+          } else if(st.erase(vadd) != (ref.erase(vadd) != 0)) {
+            std::cout << "SWISS TABLE ERASE FAILED" << std::endl;
+            return -1;
+          }
+          uint64_t v = vbase + (dist(generator) % 3000) * 4096;
+          RadixTreeIterator it = st.find(v + 0x10);
+          std::map<uint64_t, uint64_t>::iterator r = ref.find(v);
+          if(it.isValid() != (r != ref.end()) ||
+             (it.isValid() && *it != (r->second | 0x10)) ||
+             st.size() != ref.size()) {
+            std::cout << "SWISS TABLE LOOKUP FAILED" << std::endl;
+            return -1;
+          }
+        }
+        for(uint64_t v = vbase; v < vbase + 3000 * 4096; v += 4096) {
+          if(st.find(v).isValid() != (ref.count(v) != 0)) {
+            std::cout << "SWISS TABLE LOOKUP FAILED" << std::endl;
+            return -1;
+          }
+        }
+        std::cout << "  SIZE(): " << st.size() << " SLOTS(): " << st.slots()
+                  << std::endl;
+        st.clear();
+        ref.clear();
+        if(st.size() != 0 || st.slots() != (reserved ? 2048u : 16u)) {
+          std::cout << "SWISS TABLE CLEAR FAILED" << std::endl;
+          return -1;
+        }
+      }
+    }
+    // Batches of sixteen pages which the table's hash puts in the same
+    // group, one empty group after another, each erased but for its
+    // last page once full so that it holds tombstones.  Growth runs
+    // out with the table nearly empty, so it is rehashed in place
+    // rather than grown.
+    SwissTable st;
+    st.reserve(1024);
+    std::vector<uint64_t> group[128];
+    for(uint64_t v = 1, full = 0; full < 128; ++v) {
+      uint64_t h = v * 0x9e3779b97f4a7c15ULL;
+      std::vector<uint64_t> &g = group[((h ^ (h >> 32)) >> 7) % 128];
+      if(g.size() < 16) {
+        g.push_back(v);
+        full += g.size() == 16;
+      }
+    }
+    for(size_t b = 0; b < 128; ++b) {
+      for(size_t i = 0; i < 16; ++i)
+        st.insert(group[b][i] << 12, (b * 16 + i) << 12);
+      for(size_t i = 0; i < 16; i += 2) st.erase(group[b][i] << 12);
+      for(size_t i = 0; i < 16; ++i) {
+        RadixTreeIterator it = st.find(group[b][i] << 12);
+        if(it.isValid() != (i % 2 == 1) ||
+           (it.isValid() && *it != (b * 16 + i) << 12)) {
+          std::cout << "SWISS TABLE TOMBSTONE LOOKUP FAILED" << std::endl;
+          return -1;
+        }
+      }
+      for(size_t i = 1; i < 15; i += 2) st.erase(group[b][i] << 12);
+    }
+    std::cout << "  SIZE(): " << st.size() << " SLOTS(): " << st.slots()
+              << std::endl;
+    if(st.size() != 128 || st.slots() != 2048) {
+      std::cout << "SWISS TABLE GREW WHILE NEARLY EMPTY" << std::endl;
+      return -1;
+    }
+    for(size_t b = 0; b < 128; ++b) {
+      RadixTreeIterator it = st.find(group[b][15] << 12);
+      if(!it.isValid() || *it != (b * 16 + 15) << 12) {
+        std::cout << "SWISS TABLE REHASH LOST A PAGE" << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  {
+    std::cout << "========== B+ TREE TEST ==========" << std::endl;
+    if(!test_bplustree<4>(generator) || !test_bplustree<16>(generator))
+      return -1;
+  }
+
+  {
+    std::cout << "========== MAPLE TREE TEST ==========" << std::endl;
+    // Random map, unmap and protect calls over 256 pages, checked page
+    // by page against a model, along with the number of ranges, which
+    // must be the number of maximal runs of contiguous pages with the
+    // same protection.
+    MapleTree mt;
+    size_t most = 0;
+    const size_t pages = 256;
+    const uint64_t vbase = 0x7f0000000000, pbase = 0x4000000000;
+    struct Page { bool mapped; uint64_t pa; uint8_t prot; };
+    std::vector<Page> model(pages, Page{false, 0, 0});
+    for(uint32_t i = 0; i < 10 * big_test_size; ++i) {
+      size_t a = dist(generator) % pages;
+      size_t b = std::min(pages, a + 1 + dist(generator) % 32);
+      uint8_t prot = uint8_t(1 + dist(generator) % 3);
+      uint64_t start = vbase + a * 4096, end = vbase + b * 4096;
+      switch(dist(generator) % 3) {
+      case 0: {
+        // Half the time where it continues the physical run of vbase
+        uint64_t pa = dist(generator) % 2 ? pbase + a * 4096 :
+          pbase + (dist(generator) % 1024) * 4096;
+        mt.map(start, end, pa, prot);
+        for(size_t p = a; p < b; ++p)
+          model[p] = Page{true, pa + (p - a) * 4096, prot};
+        break;
+      }
+      case 1:
+        mt.unmap(start, end);
+        for(size_t p = a; p < b; ++p) model[p].mapped = false;
+        break;
+      default:
+        mt.protect(start, end, prot);
+        for(size_t p = a; p < b; ++p) model[p].prot = prot;
+      }
+      size_t ranges = 0;
+      for(size_t p = 0; p < pages; ++p) {
+        const Page &m = model[p];
+        MapleTree::iterator it = mt.find(vbase + p * 4096 + 0x10);
+        if((it != mt.end()) != m.mapped ||
+           (m.mapped && (MapleTree::translate(it, vbase + p * 4096) != m.pa ||
+                         (*it).prot != m.prot))) {
+          std::cout << "MAPLE TREE PAGE WRONG" << std::endl;
+          return -1;
+        }
+        if(m.mapped && !(p > 0 && model[p - 1].mapped &&
+                         model[p - 1].prot == m.prot &&
+                         model[p - 1].pa + 4096 == m.pa))
+          ++ranges;
+      }
+      if(mt.size() != ranges) {
+        std::cout << "MAPLE TREE RANGES NOT MERGED" << std::endl;
+        return -1;
+      }
+      most = std::max(most, ranges);
+    }
+    std::cout << "  SIZE(): " << mt.size() << " MOST: " << most
+              << " HEIGHT(): " << mt.height() << std::endl;
+  }
+
   return 0;
 }
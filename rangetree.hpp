@@ -0,0 +1,187 @@
+#ifndef RANGETREE_HPP
+#define RANGETREE_HPP
+/******************************************************************************\
+ * Range Tree
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <boost/intrusive/rbtree.hpp>
+#include <cstdint>
+
+/******************************************************************************\
+ * A MemoryRegion is a mock-up of a Linux vm_area_struct: a half-open
+ * range of virtual addresses [start, end) which is mapped to a
+ * physically contiguous range beginning at pa, with a set of
+ * permission bits.  Both ends of the range are page-aligned.
+\******************************************************************************/
+
+class MemoryRegion : public boost::intrusive::set_base_hook<
+  boost::intrusive::optimize_size<false> >
+{
+  std::uint64_t start_;
+  std::uint64_t end_;
+  std::uint64_t pa_;
+  std::uint8_t prot_;
+
+public:
+  static const std::uint8_t READ  = 0b001;
+  static const std::uint8_t WRITE = 0b010;
+  static const std::uint8_t EXEC  = 0b100;
+
+  MemoryRegion(uint64_t start, uint64_t end, uint64_t pa, uint8_t prot) :
+    start_(start), end_(end), pa_(pa), prot_(prot) {}
+
+  std::uint64_t getStart() const { return start_; }
+  std::uint64_t getEnd() const { return end_; }
+  std::uint64_t getPA() const { return pa_; }
+  std::uint8_t getProt() const { return prot_; }
+
+  bool contains(uint64_t vadd) const { return start_ <= vadd && vadd < end_; }
+
+  // Physical address of vadd, which must be contained in this region.
+  std::uint64_t translate(uint64_t vadd) const { return pa_ + (vadd - start_); }
+
+  friend class RangeTree;
+};
+
+/******************************************************************************\
+ * Range Tree.  This is a mock-up of the Linux VMA tree: a red-black
+ * tree of non-overlapping regions keyed on their start address.
+ * Rather than storing one node per 4 KB page, a node covers an
+ * arbitrarily large range, so the cost of mmap/munmap/mprotect is
+ * proportional to the number of regions touched and not to the
+ * number of pages in them.
+ *
+ * Like the kernel, map() over an existing range replaces it
+ * (MAP_FIXED semantics), unmap() and protect() split any region
+ * straddling either end of the range, and neighbours which are
+ * virtually and physically contiguous with equal permissions are
+ * merged back together.
+\******************************************************************************/
+
+class RangeTree {
+  struct region_start {
+    typedef std::uint64_t type;
+    const type& operator()(const MemoryRegion& r) const { return r.start_; }
+  };
+
+  typedef boost::intrusive::rbtree<
+    MemoryRegion,
+    boost::intrusive::key_of_value<region_start> > tree_t;
+
+  struct disposer {
+    void operator()(MemoryRegion *r) { delete r; }
+  };
+
+  tree_t t_;
+
+  static bool mergeable(const MemoryRegion &a, const MemoryRegion &b) {
+    return a.end_ == b.start_ &&
+      a.prot_ == b.prot_ &&
+      a.pa_ + (a.end_ - a.start_) == b.pa_;
+  }
+
+  // Returns the first region whose end lies above vadd, i.e. the
+  // region containing vadd if there is one, and otherwise the first
+  // region after it.
+  tree_t::iterator first_ending_after(uint64_t vadd) {
+    tree_t::iterator it = t_.upper_bound(vadd);
+    if(it != t_.begin()) {
+      tree_t::iterator prev = it;
+      --prev;
+      if(prev->end_ > vadd) return prev;
+    }
+    return it;
+  }
+
+  // Ensure that no region straddles vadd, splitting one if needed.
+  void split_at(uint64_t vadd) {
+    tree_t::iterator it = first_ending_after(vadd);
+    if(it == t_.end() || it->start_ >= vadd) return;
+    MemoryRegion *tail = new MemoryRegion(vadd, it->end_,
+                                          it->translate(vadd), it->prot_);
+    it->end_ = vadd;
+    t_.insert_unique(*tail);
+  }
+
+  // Merge the region at it with its neighbours where possible, and
+  // return an iterator to the merged region.
+  tree_t::iterator merge_around(tree_t::iterator it) {
+    if(it != t_.begin()) {
+      tree_t::iterator prev = it;
+      --prev;
+      if(mergeable(*prev, *it)) {
+        prev->end_ = it->end_;
+        t_.erase_and_dispose(it, disposer());
+        it = prev;
+      }
+    }
+    tree_t::iterator next = it;
+    ++next;
+    if(next != t_.end() && mergeable(*it, *next)) {
+      it->end_ = next->end_;
+      t_.erase_and_dispose(next, disposer());
+    }
+    return it;
+  }
+
+public:
+  typedef tree_t::iterator iterator;
+
+  static const std::uint64_t page_size = 4096;
+
+  RangeTree() : t_() {}
+  ~RangeTree() { clear(); }
+
+  // mmap(MAP_FIXED): map [start, end) to the physical range beginning
+  // at pa, replacing anything previously mapped there.
+  void map(uint64_t start, uint64_t end, uint64_t pa, uint8_t prot) {
+    unmap(start, end);
+    iterator it = t_.insert_unique(*new MemoryRegion(start, end, pa, prot)).first;
+    merge_around(it);
+  }
+
+  // munmap: remove every mapping in [start, end).
+  void unmap(uint64_t start, uint64_t end) {
+    split_at(start);
+    split_at(end);
+    iterator it = first_ending_after(start);
+    while(it != t_.end() && it->start_ < end)
+      it = t_.erase_and_dispose(it, disposer());
+  }
+
+  // mprotect: change the permissions of every mapping in [start, end).
+  void protect(uint64_t start, uint64_t end, uint8_t prot) {
+    split_at(start);
+    split_at(end);
+    iterator it = first_ending_after(start);
+    while(it != t_.end() && it->start_ < end) {
+      it->prot_ = prot;
+      it = merge_around(it);
+      ++it;
+    }
+    // The region following the range may now merge with the last one
+    // changed.
+    if(it != t_.end()) merge_around(it);
+  }
+
+  // Returns the region covering vadd, or end() if it is unmapped.
+  iterator find(uint64_t vadd) {
+    iterator it = first_ending_after(vadd);
+    if(it == t_.end() || !it->contains(vadd)) return t_.end();
+    return it;
+  }
+
+  iterator begin() { return t_.begin(); }
+  iterator end() { return t_.end(); }
+  void clear() { t_.clear_and_dispose(disposer()); }
+  size_t size() { return t_.size(); }
+  // Bytes of memory held by the tree and its regions.
+  size_t memory_bytes() {
+    return sizeof(*this) + size() * sizeof(MemoryRegion);
+  }
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,240 @@
+#ifndef SWISS_TABLE_HPP
+#define SWISS_TABLE_HPP
+/******************************************************************************\
+ * Swiss Table
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Swiss Table.  A flat open-addressed map from virtual page number to
+ * physical frame, after the SwissTable design.  Beside the array of
+ * 16-byte slots, holding each key and value inline, is an array of
+ * one-byte control words, one per slot: empty, deleted, or the low
+ * seven bits of a full slot's hash.
+ *
+ * Slots are probed sixteen at a time.  A single SSE2 compare of the
+ * group's control words against the hash finds every candidate slot
+ * at once, and in nearly every case only the key that matched is
+ * read.  A probe stops at the first group with an empty slot, so a
+ * lookup usually touches one cache line of control words and one of
+ * slots.  Without SSE2 the same masks are built byte by byte.
+ *
+ * The table is at most 7/8 full, and erased slots become tombstones
+ * only where a probe may have passed through their group.
+\******************************************************************************/
+
+class SwissTable {
+  static const unsigned page_shift = 12;
+  static const size_t group_width = 16;
+  static const int8_t EMPTY = -128;   // 0b10000000
+  static const int8_t DELETED = -2;   // 0b11111110
+
+  struct Slot {
+    uint64_t vpn;
+    uint64_t pa;
+  };
+
+  // The control words of one group of slots, with a bit mask for each
+  // kind of match.
+  struct Group {
+#ifdef __SSE2__
+    __m128i ctrl;
+    explicit Group(const int8_t *p)
+      : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+    uint32_t match(int8_t h2) const {
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+    }
+    uint32_t match_empty() const { return match(EMPTY); }
+    // Full slots have the top bit clear, the others have it set
+    uint32_t match_free() const { return _mm_movemask_epi8(ctrl); }
+#else
+    const int8_t *ctrl;
+    explicit Group(const int8_t *p) : ctrl(p) {}
+    uint32_t match(int8_t h2) const {
+      uint32_t m = 0;
+      for(size_t i = 0; i < group_width; ++i)
+        if(ctrl[i] == h2) m |= 1u << i;
+      return m;
+    }
+    uint32_t match_empty() const { return match(EMPTY); }
+    uint32_t match_free() const {
+      uint32_t m = 0;
+      for(size_t i = 0; i < group_width; ++i)
+        if(ctrl[i] < 0) m |= 1u << i;
+      return m;
+    }
+#endif
+  };
+
+  int8_t *ctrl_;
+  Slot *slots_;
+  size_t groups_;     // Always a power of two
+  size_t s_;
+  size_t growth_;     // Inserts left before the table must grow
+  size_t reserved_;   // Groups kept by clear()
+
+  static uint64_t vpn(uint64_t vadd) {
+    return (vadd & ((1ULL << 48) - 1)) >> page_shift;
+  }
+
+  static uint64_t hash(uint64_t vpn) {
+    uint64_t h = vpn * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+  }
+  static int8_t h2(uint64_t h) { return int8_t(h & 0x7f); }
+  size_t h1(uint64_t h) const { return size_t(h >> 7) & (groups_ - 1); }
+
+  size_t capacity() const { return groups_ * group_width; }
+  static size_t max_load(size_t cap) { return cap - cap / 8; }
+
+  void allocate(size_t groups) {
+    size_t cap = groups * group_width;
+    void *p = NULL;
+    if(posix_memalign(&p, 64, cap * (sizeof(Slot) + 1)) != 0)
+      throw std::bad_alloc();
+    slots_ = static_cast<Slot*>(p);
+    ctrl_ = reinterpret_cast<int8_t*>(slots_ + cap);
+    memset(ctrl_, EMPTY, cap);
+    groups_ = groups;
+    growth_ = max_load(cap);
+  }
+
+  // Finds the first free slot on the probe sequence of hash h.  The
+  // groups are visited in triangular order, which reaches every group
+  // of a power-of-two table.
+  size_t find_free(uint64_t h) const {
+    size_t g = h1(h);
+    for(size_t step = 1; ; ++step) {
+      uint32_t m = Group(ctrl_ + g * group_width).match_free();
+      if(m) return g * group_width + __builtin_ctz(m);
+      g = (g + step) & (groups_ - 1);
+    }
+  }
+
+  // Index of the slot holding vpn v, or -1.
+  size_t lookup(uint64_t v) const {
+    uint64_t h = hash(v);
+    size_t g = h1(h);
+    for(size_t step = 1; ; ++step) {
+      Group grp(ctrl_ + g * group_width);
+      for(uint32_t m = grp.match(h2(h)); m; m &= m - 1) {
+        size_t i = g * group_width + __builtin_ctz(m);
+        if(slots_[i].vpn == v) return i;
+      }
+      if(grp.match_empty()) return size_t(-1);
+      g = (g + step) & (groups_ - 1);
+    }
+  }
+
+  // Resizes to the given number of groups, dropping tombstones.
+  void rehash(size_t groups) {
+    int8_t *oldCtrl = ctrl_;
+    Slot *oldSlots = slots_;
+    size_t oldCap = capacity();
+    allocate(groups);
+    for(size_t i = 0; i < oldCap; ++i) {
+      if(oldCtrl[i] < 0) continue;
+      uint64_t h = hash(oldSlots[i].vpn);
+      size_t j = find_free(h);
+      ctrl_[j] = h2(h);
+      slots_[j] = oldSlots[i];
+    }
+    growth_ -= s_;
+    ::free(oldSlots);
+  }
+
+public:
+  SwissTable() : s_(0), reserved_(1) { allocate(1); }
+  SwissTable(const SwissTable&) = delete;
+  SwissTable& operator=(const SwissTable&) = delete;
+  ~SwissTable() { ::free(slots_); }
+
+  // Sizes the table to hold n pages without growing, now and after
+  // every clear().
+  void reserve(size_t n) {
+    size_t groups = 1;
+    while(max_load(groups * group_width) < n) groups *= 2;
+    reserved_ = groups;
+    if(groups > groups_) rehash(groups);
+  }
+
+  void insert(uint64_t vadd, uint64_t padd) {
+    uint64_t v = vpn(vadd), pa = padd & ~((1ULL << page_shift) - 1);
+    size_t i = lookup(v);
+    if(i != size_t(-1)) {
+      slots_[i].pa = pa;
+      return;
+    }
+    uint64_t h = hash(v);
+    i = find_free(h);
+    // Reusing a tombstone costs nothing; taking an empty slot uses up
+    // growth, and once that is gone the table either grows or, if it
+    // is mostly tombstones, is rehashed in place.
+    if(ctrl_[i] == EMPTY && growth_ == 0) {
+      rehash(s_ + 1 > max_load(capacity()) / 2 ? groups_ * 2 : groups_);
+      i = find_free(h);
+    }
+    if(ctrl_[i] == EMPTY) --growth_;
+    ctrl_[i] = h2(h);
+    slots_[i].vpn = v;
+    slots_[i].pa = pa;
+    ++s_;
+  }
+
+  // Removes the page containing vadd, returning whether it was mapped.
+  bool erase(uint64_t vadd) {
+    size_t i = lookup(vpn(vadd));
+    if(i == size_t(-1)) return false;
+    // A group with an empty slot ends every probe that reaches it, so
+    // none can have passed through it and the slot may be emptied.
+    size_t g = i / group_width * group_width;
+    if(Group(ctrl_ + g).match_empty()) {
+      ctrl_[i] = EMPTY;
+      ++growth_;
+    } else {
+      ctrl_[i] = DELETED;
+    }
+    --s_;
+    return true;
+  }
+
+  RadixTreeIterator find(uint64_t vadd) {
+    size_t i = lookup(vpn(vadd));
+    if(i == size_t(-1)) return end();
+    return RadixTreeIterator(vadd, slots_[i].pa |
+                             (vadd & ((1ULL << page_shift) - 1)));
+  }
+
+  RadixTreeIterator end() { return RadixTreeIterator(-1, -1, true); }
+
+  // Empties the table, shrinking it back to the reserved size.
+  void clear() {
+    s_ = 0;
+    if(groups_ != reserved_) {
+      ::free(slots_);
+      allocate(reserved_);
+    } else {
+      memset(ctrl_, EMPTY, capacity());
+      growth_ = max_load(capacity());
+    }
+  }
+
+  size_t size() { return s_; }
+  size_t slots() { return capacity(); }
+  size_t memory_bytes() {
+    return sizeof(*this) + capacity() * (sizeof(Slot) + 1);
+  }
+};
+
+/******************************************************************************/
+#endif
@@ -0,0 +1,251 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+/******************************************************************************\
+ * Translation Traces
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <stdexcept>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/******************************************************************************\
+ * A trace is a sequence of (op, vaddr, paddr) records, in one of two
+ * formats.
+ *
+ * Binary traces begin with the 8-byte magic "VMTRACE1" and are
+ * followed by TraceRecords in host byte order, 24 bytes each.  They
+ * are read in place, straight out of the mapped file.
+ *
+ * Text traces have one record per line,
+ *
+ *   <op> <vaddr> [<paddr>]
+ *
+ * where op is i (insert), l (lookup) or e (erase), or any word
+ * beginning with one of those letters, and the addresses are decimal
+ * or 0x-prefixed hex.  paddr is only needed for inserts.  Blank lines
+ * and lines beginning with # are skipped.  Lines are parsed as they
+ * are reached, so a text trace is never held in memory either.
+\******************************************************************************/
+
+struct TraceRecord {
+  enum Op { INSERT = 0, LOOKUP = 1, ERASE = 2 };
+  static const unsigned num_ops = 3;
+
+  uint8_t op;
+  uint8_t pad[7];
+  uint64_t vaddr;
+  uint64_t paddr;
+
+  static const char *name(unsigned op) {
+    const char *names[] = { "insert", "lookup", "erase" };
+    return op < num_ops ? names[op] : "unknown";
+  }
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord must be packed");
+
+/******************************************************************************\
+ * Trace.  Maps a trace file read-only and hands out cursors which
+ * stream its records.  Opening a trace only maps it and checks for
+ * the binary magic, so it costs the same whatever the size of the
+ * file; the kernel pages it in as the cursor reaches it.  Throws
+ * std::runtime_error if the file cannot be mapped or is malformed.
+\******************************************************************************/
+
+class Trace {
+  const char *data_;
+  size_t bytes_;
+  bool binary_;
+
+public:
+  static const size_t magic_bytes = 8;
+  static const char *magic() { return "VMTRACE1"; }
+
+  class Cursor {
+    const char *p_;
+    const char *end_;
+    bool binary_;
+    size_t line_;
+
+    static bool space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void skip_space() { while(p_ != end_ && space(*p_)) ++p_; }
+
+    void skip_line() {
+      const void *nl = memchr(p_, '\n', end_ - p_);
+      p_ = nl == NULL ? end_ : static_cast<const char*>(nl) + 1;
+      ++line_;
+    }
+
+    void fail(const char *what) {
+      throw std::runtime_error("trace line " + std::to_string(line_) +
+                               ": " + what);
+    }
+
+    // Parses a decimal or 0x-prefixed hex number.
+    uint64_t number() {
+      skip_space();
+      uint64_t n = 0;
+      const char *start = p_;
+      if(end_ - p_ > 2 && p_[0] == '0' && (p_[1] == 'x' || p_[1] == 'X')) {
+        p_ += 2;
+        start = p_;
+        for(; p_ != end_; ++p_) {
+          char c = *p_;
+          if(c >= '0' && c <= '9') n = (n << 4) | (c - '0');
+          else if(c >= 'a' && c <= 'f') n = (n << 4) | (c - 'a' + 10);
+          else if(c >= 'A' && c <= 'F') n = (n << 4) | (c - 'A' + 10);
+          else break;
+        }
+      } else {
+        for(; p_ != end_ && *p_ >= '0' && *p_ <= '9'; ++p_)
+          n = n * 10 + (*p_ - '0');
+      }
+      if(p_ == start) fail("expected an address");
+      return n;
+    }
+
+    bool next_text(TraceRecord &r) {
+      for(;;) {
+        skip_space();
+        if(p_ == end_) return false;
+        if(*p_ == '\n' || *p_ == '#') {
+          skip_line();
+          continue;
+        }
+        switch(*p_ | 0x20) {
+        case 'i': r.op = TraceRecord::INSERT; break;
+        case 'l': r.op = TraceRecord::LOOKUP; break;
+        case 'e': r.op = TraceRecord::ERASE; break;
+        default: fail("unknown op");
+        }
+        while(p_ != end_ && !space(*p_) && *p_ != '\n') ++p_;
+        r.vaddr = number();
+        skip_space();
+        if(p_ != end_ && *p_ != '\n' && *p_ != '#') r.paddr = number();
+        else if(r.op == TraceRecord::INSERT) fail("insert needs a paddr");
+        else r.paddr = 0;
+        skip_line();
+        return true;
+      }
+    }
+
+  public:
+    Cursor(const char *begin, const char *end, bool binary) :
+      p_(begin), end_(end), binary_(binary), line_(1) {}
+
+    // Reads the next record into r, returning false at the end of the
+    // trace.
+    bool next(TraceRecord &r) {
+      if(!binary_) return next_text(r);
+      if(p_ == end_) return false;
+      r = *reinterpret_cast<const TraceRecord*>(p_);
+      p_ += sizeof(TraceRecord);
+      if(r.op >= TraceRecord::num_ops) fail("unknown op");
+      return true;
+    }
+  };
+
+  explicit Trace(const char *path) : data_(NULL), bytes_(0), binary_(false) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) throw std::runtime_error(std::string("cannot open ") + path);
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error(std::string("cannot stat ") + path);
+    }
+    bytes_ = st.st_size;
+    if(bytes_ > 0) {
+      void *p = mmap(NULL, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(p == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error(std::string("cannot map ") + path);
+      }
+      madvise(p, bytes_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(p);
+    }
+    // The mapping keeps the file open.
+    close(fd);
+    binary_ = bytes_ >= magic_bytes &&
+      memcmp(data_, magic(), magic_bytes) == 0;
+    if(binary_ && (bytes_ - magic_bytes) % sizeof(TraceRecord) != 0) {
+      munmap(const_cast<char*>(data_), bytes_);
+      throw std::runtime_error(std::string(path) +
+                               ": truncated binary trace");
+    }
+  }
+  Trace(const Trace&) = delete;
+  Trace& operator=(const Trace&) = delete;
+  ~Trace() {
+    if(data_ != NULL) munmap(const_cast<char*>(data_), bytes_);
+  }
+
+  bool binary() { return binary_; }
+  size_t bytes() { return bytes_; }
+
+  // Number of records, which is only known without reading the trace
+  // for binary traces.
+  size_t size() {
+    return binary_ ? (bytes_ - magic_bytes) / sizeof(TraceRecord) : 0;
+  }
+
+  Cursor records() {
+    return binary_ ?
+      Cursor(data_ + magic_bytes, data_ + bytes_, true) :
+      Cursor(data_, data_ + bytes_, false);
+  }
+};
+
+/******************************************************************************\
+ * Trace Writer.  Writes a binary trace, buffered through stdio.
+\******************************************************************************/
+
+class TraceWriter {
+  FILE *f_;
+
+public:
+  explicit TraceWriter(const char *path) : f_(fopen(path, "wb")) {
+    if(f_ == NULL)
+      throw std::runtime_error(std::string("cannot write ") + path);
+    if(fwrite(Trace::magic(), Trace::magic_bytes, 1, f_) != 1) {
+      fclose(f_);
+      throw std::runtime_error(std::string("cannot write ") + path);
+    }
+  }
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  // Closes without checking; call close() to know the trace is whole.
+  ~TraceWriter() { if(f_ != NULL) fclose(f_); }
+
+  // Flushes and closes the trace, throwing if any of it failed to
+  // reach the file.
+  void close() {
+    FILE *f = f_;
+    f_ = NULL;
+    bool flushed = fflush(f) == 0;
+    if(fclose(f) != 0 || !flushed)
+      throw std::runtime_error("trace write failed");
+  }
+
+  void write(unsigned op, uint64_t vaddr, uint64_t paddr) {
+    TraceRecord r;
+    memset(&r, 0, sizeof(r));
+    r.op = op;
+    r.vaddr = vaddr;
+    r.paddr = paddr;
+    if(fwrite(&r, sizeof(r), 1, f_) != 1)
+      throw std::runtime_error("trace write failed");
+  }
+};
+
+/******************************************************************************/
+#endif
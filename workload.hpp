@@ -0,0 +1,246 @@
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+/******************************************************************************\
+ * Workload Generator
+ * MIT License
+ * Copyright 2016, Simon Pratt
+\******************************************************************************/
+
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include "radixtree.hpp"
+
+/******************************************************************************\
+ * Workload.  Generates the mappings a benchmark inserts, the order it
+ * inserts them in and the order it looks them up in, from a single
+ * seeded generator, so that a run can be repeated exactly.
+ *
+ * The layout decides where the mappings lie in the address space:
+ *
+ *   uniform     distinct random pages anywhere in the 48-bit space
+ *   clustered   a process-like address space: a heap growing up from
+ *               0x555555554000, mmap regions growing up from
+ *               0x7f0000000000 and a stack growing down from
+ *               0x7ffffffff000, each with occasional holes
+ *   sequential  consecutive pages
+ *   strided     one page every `stride' pages
+ *
+ * Each order is one of
+ *
+ *   shuffled    every mapping once, in random order
+ *   sorted      every mapping once, in address order
+ *   strided     every mapping once, in address order but visiting
+ *               every 16th mapping on each of 16 passes
+ *   zipfian     (lookups only) random mappings drawn with a Zipf
+ *               distribution of the given skew, so that a few hot
+ *               mappings take most of the lookups
+ *
+ * Mappings are of any type M constructible from (vadd, padd) and
+ * ordered by virtual address with operator<.
+\******************************************************************************/
+
+class Workload {
+public:
+  enum Layout { UNIFORM, CLUSTERED, SEQUENTIAL, STRIDED };
+  enum Order { SHUFFLED, SORTED, STRIDE, ZIPFIAN };
+
+  Layout layout;
+  Order insertOrder;
+  Order lookupOrder;
+  uint64_t seed;
+  uint64_t stride;   // In pages, for the strided layout
+  double skew;       // Zipf exponent, for zipfian lookups
+
+private:
+  static const uint64_t page = 4096;
+  std::mt19937_64 gen_;
+
+  uint64_t random() { return gen_(); }
+
+  template<class M>
+  void reorder(std::vector<M> &v, Order o) {
+    switch(o) {
+    case SORTED:
+      std::sort(v.begin(), v.end());
+      break;
+    case STRIDE: {
+      const std::size_t passes = 16;
+      std::sort(v.begin(), v.end());
+      std::vector<M> out;
+      out.reserve(v.size());
+      for(std::size_t p = 0; p < passes; ++p)
+        for(std::size_t i = p; i < v.size(); i += passes)
+          out.push_back(v[i]);
+      v.swap(out);
+      break;
+    }
+    default:
+      std::shuffle(v.begin(), v.end(), gen_);
+      break;
+    }
+  }
+
+  static const char *name(Order o) {
+    const char *names[] = { "shuffled", "sorted", "strided", "zipfian" };
+    return names[o];
+  }
+
+  static bool parse_order(const char *s, Order &o) {
+    for(int i = SHUFFLED; i <= ZIPFIAN; ++i) {
+      if(strcmp(s, name(Order(i))) == 0) {
+        o = Order(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  Workload() : layout(UNIFORM), insertOrder(SHUFFLED), lookupOrder(SHUFFLED),
+               seed(1), stride(513), skew(0.99), gen_(1) {}
+
+  // Restarts the generator from the seed.
+  void reset() { gen_.seed(seed); }
+
+  // Consumes a command-line option of the form --layout=clustered,
+  // --insert=sorted, --lookup=zipfian, --seed=42, --stride=513 or
+  // --skew=1.2, returning false if it is not one of these.
+  bool parse(const char *arg) {
+    const char *layouts[] = { "uniform", "clustered", "sequential",
+                              "strided" };
+    if(strncmp(arg, "--layout=", 9) == 0) {
+      for(int i = UNIFORM; i <= STRIDED; ++i) {
+        if(strcmp(arg + 9, layouts[i]) == 0) {
+          layout = Layout(i);
+          return true;
+        }
+      }
+      return false;
+    }
+    if(strncmp(arg, "--insert=", 9) == 0)
+      return parse_order(arg + 9, insertOrder) && insertOrder != ZIPFIAN;
+    if(strncmp(arg, "--lookup=", 9) == 0)
+      return parse_order(arg + 9, lookupOrder);
+    if(strncmp(arg, "--seed=", 7) == 0) {
+      seed = strtoull(arg + 7, NULL, 0);
+      reset();
+      return true;
+    }
+    if(strncmp(arg, "--stride=", 9) == 0) {
+      stride = strtoull(arg + 9, NULL, 0);
+      return stride > 0;
+    }
+    if(strncmp(arg, "--skew=", 7) == 0) {
+      skew = strtod(arg + 7, NULL);
+      return skew > 0;
+    }
+    return false;
+  }
+
+  static const char *usage() {
+    return "[--layout=uniform|clustered|sequential|strided]"
+      " [--insert=shuffled|sorted|strided]"
+      " [--lookup=shuffled|sorted|strided|zipfian]"
+      " [--seed=N] [--stride=PAGES] [--skew=S]";
+  }
+
+  std::string describe() {
+    const char *layouts[] = { "uniform", "clustered", "sequential",
+                              "strided" };
+    return std::string("layout=") + layouts[layout] +
+      " insert=" + name(insertOrder) +
+      " lookup=" + name(lookupOrder) +
+      " seed=" + std::to_string(seed);
+  }
+
+  // Appends n mappings of distinct pages to values, in the order they
+  // are laid out.
+  template<class M>
+  void mappings(std::size_t n, std::vector<M> &values) {
+    // Next free page of the heap, mmap area and stack (growing down)
+    uint64_t heap = 0x555555554000, mmap = 0x7f0000000000;
+    uint64_t stack = 0x7ffffffff000;
+    std::unordered_set<uint64_t> used;
+    for(std::size_t i = 0; i < n; ++i) {
+      uint64_t vpage;
+      switch(layout) {
+      case CLUSTERED: {
+        // An occasional hole of up to 16 pages
+        uint64_t hole = random() % 16 == 0 ? 1 + random() % 16 : 0;
+        uint64_t r = random() % 10;
+        if(r < 5) {
+          vpage = heap + hole * page;
+          heap = vpage + page;
+        } else if(r < 9) {
+          vpage = mmap + hole * page;
+          mmap = vpage + page;
+        } else {
+          vpage = stack - hole * page;
+          stack = vpage - page;
+        }
+        break;
+      }
+      case SEQUENTIAL:
+        vpage = 0x10000000 + i * page;
+        break;
+      case STRIDED:
+        vpage = 0x10000000 + i * stride * page;
+        break;
+      default:
+        do {
+          vpage = correctify_vadd(random()) & ~(page - 1);
+        } while(!used.insert(vpage).second);
+        break;
+      }
+      uint64_t vadd = vpage | (random() & (page - 1));
+      values.push_back(M(vadd, correctify_padd(vadd, random())));
+    }
+  }
+
+  // Puts values into the insert order.
+  template<class M>
+  void order_inserts(std::vector<M> &values) {
+    reorder(values, insertOrder);
+  }
+
+  // Appends n lookups of the given values to out, in the lookup
+  // order.  Unless the order is zipfian, n should be values.size().
+  template<class M>
+  void lookups(const std::vector<M> &values, std::size_t n,
+               std::vector<M> &out) {
+    if(lookupOrder != ZIPFIAN) {
+      std::vector<M> v(values);
+      reorder(v, lookupOrder);
+      for(std::size_t i = 0; i < n; ++i) out.push_back(v[i % v.size()]);
+      return;
+    }
+    // Hot mappings are scattered across the address space: rank r is
+    // held by values[rank[r]].
+    std::vector<std::size_t> rank(values.size());
+    for(std::size_t i = 0; i < rank.size(); ++i) rank[i] = i;
+    std::shuffle(rank.begin(), rank.end(), gen_);
+    std::vector<double> cdf(values.size());
+    double total = 0.0;
+    for(std::size_t r = 0; r < cdf.size(); ++r) {
+      total += 1.0 / std::pow(double(r + 1), skew);
+      cdf[r] = total;
+    }
+    std::uniform_real_distribution<double> u(0.0, total);
+    for(std::size_t i = 0; i < n; ++i) {
+      std::size_t r = std::lower_bound(cdf.begin(), cdf.end(), u(gen_)) -
+        cdf.begin();
+      if(r == cdf.size()) r = cdf.size() - 1;
+      out.push_back(values[rank[r]]);
+    }
+  }
+};
+
+/******************************************************************************/
+#endif